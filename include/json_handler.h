@@ -24,12 +24,100 @@
 #ifndef JSON_HANDLER_H
 #define JSON_HANDLER_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// request is a JSON object with 'meta', 'headers' and 'data' fields,
+// 'data.format' names the 'data' field that holds the body:
+//  - 'json', 'string', 'stringHex': body in memory
+//  - 'file': path of the body spilled to disk
+//  - 'fd': descriptor of the spilled body ('json_handler_body_fd on'),
+//    closed by nginx when request is finalized, use dup() to keep it;
+//    file offset is at the end of the body (and is shared with dup()
+//    copies), use pread() or mmap() rather than read()
+//
+// 'data.extracted' ('json_handler_extract'): selected values keyed by
+// JSON Pointer, null when body is not a valid JSON; with 'drop_body'
+// option 'format' is 'extracted' and the body is omitted, body is not
+// parsed then, so duplicate keys are only rejected on the extracted
+// paths and inside extracted values
 int submit_json_request(const char* req_json);
 
+typedef struct json_handler_header {
+    const char* key;
+    size_t key_len;
+    const char* value;
+    size_t value_len;
+} json_handler_header;
+
+typedef struct json_handler_response {
+    // 200 is used when not set
+    int status;
+    const json_handler_header* headers;
+    size_t headers_count;
+    const char* body;
+    size_t body_len;
+    // called after response data is copied by nginx, can be NULL
+    void (*release)(struct json_handler_response* resp);
+    void* release_data;
+} json_handler_response;
+
+// optional, called before 'submit_json_request' if exported by the library,
+// must return 0 after filling 'resp', positive value to submit the request
+// asynchronously, negative value on error
+int handle_json_request_sync(const char* req_json, json_handler_response* resp);
+
+typedef struct json_handler_api {
+    // thread-safe, asks nginx worker to issue a subrequest to the specified
+    // local URI on behalf of the client request, result is passed
+    // to 'receive_subrequest_response' together with the specified tag,
+    // must be called before the response for this request is sent
+    int (*subrequest)(long long request_handle, const char* uri, const char* args, long long tag);
+} json_handler_api;
+
+// optional, called on worker startup before any requests are submitted,
+// non-zero result fails worker initialization; library itself is loaded
+// by nginx master process before workers are forked, so threads must be
+// started here rather than in library constructors
+//
+// 'json_handler_library' notes:
+//  - library constructors run in nginx master process, usually as root
+//  - on configuration reload the library is re-opened, a library that
+//    cannot be unloaded (e.g. Rust cdylib) keeps its old version mapped
+//    until nginx restart, a warning is logged in that case
+//  - library that cannot be loaded fails the configuration load,
+//    on reload running workers keep the previous configuration
+int init_json_handler(const json_handler_api* api);
+
+// optional, required for subrequests, called from nginx worker thread with
+// JSON object with 'requestHandle', 'tag', 'status', 'headers' and 'body'
+// (or 'bodyHex' for non-UTF-8 data) fields, must not block
+void receive_subrequest_response(const char* resp_json);
+
+// optional, called on worker startup (and after hot reload) after
+// 'init_json_handler' before any requests are submitted, can be used to fill
+// caches and connection pools, non-zero result is logged as a warning;
+// on hot reload both calls block the worker event loop until they return
+int warmup_json_handler();
+
+// optional, called before the library is unloaded after hot reload
+// ('json_handler_reload' location), when all requests submitted to it are
+// finished, must stop all library threads, library is never unloaded
+// if this function is not exported
+//
+// 'json_handler_reload' location loads code into every worker, access
+// to it must be restricted (e.g. 'allow 127.0.0.1; deny all;'); its
+// 'library' argument is a file name from the directory of the configured
+// 'json_handler_library'
+void shutdown_json_handler();
+
+// used instead of 'submit_json_request' when 'json_handler_format'
+// is set to 'cbor' or 'msgpack', see json_handler_envelope.h
+int submit_binary_request(const char* req, size_t req_len);
+
 #ifdef __cplusplus
 }
 #endif
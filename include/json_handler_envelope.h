@@ -0,0 +1,273 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_ENVELOPE_H
+#define JSON_HANDLER_ENVELOPE_H
+
+/*
+ * Pull reader for binary request envelopes passed to 'submit_binary_request'.
+ *
+ * Envelope has the same structure as JSON one: a map with 'meta', 'headers'
+ * and 'data' keys. In 'data', 'stringHex' is replaced with 'bytes' key:
+ * non-UTF-8 request bodies are passed there as a byte string (without
+ * hex encoding) with 'format' set to 'bytes'.
+ *
+ * 'handle_json_request_sync' is not called with binary envelopes, all
+ * requests go to 'submit_binary_request'.
+ *
+ * Each call to 'jh_envelope_read' returns next item, for maps and arrays
+ * 'count' contains the number of entries that follow (key and value for
+ * each map entry). String and byte items point into the envelope buffer.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JH_ENVELOPE_CBOR 1
+#define JH_ENVELOPE_MSGPACK 2
+
+#define JH_ITEM_ERROR -1
+#define JH_ITEM_END 0
+#define JH_ITEM_MAP 1
+#define JH_ITEM_ARRAY 2
+#define JH_ITEM_STRING 3
+#define JH_ITEM_BYTES 4
+#define JH_ITEM_INT 5
+#define JH_ITEM_DOUBLE 6
+#define JH_ITEM_BOOL 7
+#define JH_ITEM_NULL 8
+
+typedef struct jh_envelope_item {
+    int type;
+    size_t count;
+    const char* data;
+    size_t len;
+    long long int_value;
+    double double_value;
+    int bool_value;
+} jh_envelope_item;
+
+typedef struct jh_envelope_reader {
+    int format;
+    const unsigned char* pos;
+    const unsigned char* end;
+} jh_envelope_reader;
+
+static inline void jh_envelope_reader_init(jh_envelope_reader* reader, int format,
+        const char* data, size_t len) {
+    reader->format = format;
+    reader->pos = (const unsigned char*) data;
+    reader->end = reader->pos + len;
+}
+
+// big-endian, returns -1 on truncated input
+static inline int jh_envelope_uint(jh_envelope_reader* reader, size_t width, uint64_t* val) {
+    if ((size_t) (reader->end - reader->pos) < width) {
+        return -1;
+    }
+    *val = 0;
+    for (size_t i = 0; i < width; i++) {
+        *val = (*val << 8) | reader->pos[i];
+    }
+    reader->pos += width;
+    return 0;
+}
+
+static inline int jh_envelope_payload(jh_envelope_reader* reader, jh_envelope_item* item,
+        int type, uint64_t len) {
+    if ((uint64_t) (reader->end - reader->pos) < len) {
+        return JH_ITEM_ERROR;
+    }
+    item->type = type;
+    item->data = (const char*) reader->pos;
+    item->len = (size_t) len;
+    reader->pos += len;
+    return type;
+}
+
+static inline double jh_envelope_double(uint64_t bits, size_t width) {
+    if (4 == width) {
+        uint32_t bits32 = (uint32_t) bits;
+        float fl;
+        memcpy(&fl, &bits32, sizeof(fl));
+        return fl;
+    }
+    double dbl;
+    memcpy(&dbl, &bits, sizeof(dbl));
+    return dbl;
+}
+
+static inline int jh_envelope_read_cbor(jh_envelope_reader* reader, jh_envelope_item* item) {
+    unsigned char head = *reader->pos++;
+    unsigned char major = head >> 5;
+    unsigned char info = head & 0x1f;
+    uint64_t arg = info;
+    size_t width = 0;
+    if (info >= 24 && info <= 27) {
+        width = (size_t) 1 << (info - 24);
+        if (0 != jh_envelope_uint(reader, width, &arg)) return JH_ITEM_ERROR;
+    } else if (info > 27) { // indefinite lengths are not used
+        return JH_ITEM_ERROR;
+    }
+    switch (major) {
+    case 0:
+        if (arg > INT64_MAX) return JH_ITEM_ERROR;
+        item->int_value = (long long) arg;
+        return item->type = JH_ITEM_INT;
+    case 1:
+        if (arg > INT64_MAX) return JH_ITEM_ERROR;
+        item->int_value = -1 - (long long) arg;
+        return item->type = JH_ITEM_INT;
+    case 2:
+        return jh_envelope_payload(reader, item, JH_ITEM_BYTES, arg);
+    case 3:
+        return jh_envelope_payload(reader, item, JH_ITEM_STRING, arg);
+    case 4:
+        item->count = (size_t) arg;
+        return item->type = JH_ITEM_ARRAY;
+    case 5:
+        item->count = (size_t) arg;
+        return item->type = JH_ITEM_MAP;
+    case 7:
+        if (20 == info || 21 == info) {
+            item->bool_value = 21 == info;
+            return item->type = JH_ITEM_BOOL;
+        }
+        if (22 == info) {
+            return item->type = JH_ITEM_NULL;
+        }
+        if (26 == info || 27 == info) {
+            item->double_value = jh_envelope_double(arg, width);
+            return item->type = JH_ITEM_DOUBLE;
+        }
+        return JH_ITEM_ERROR;
+    default:
+        return JH_ITEM_ERROR;
+    }
+}
+
+static inline int jh_envelope_read_msgpack(jh_envelope_reader* reader, jh_envelope_item* item) {
+    unsigned char head = *reader->pos++;
+    uint64_t arg = 0;
+
+    if (head <= 0x7f) {
+        item->int_value = head;
+        return item->type = JH_ITEM_INT;
+    }
+    if (head >= 0xe0) {
+        item->int_value = (long long) head - 0x100;
+        return item->type = JH_ITEM_INT;
+    }
+    if (head >= 0x80 && head <= 0x8f) {
+        item->count = head & 0x0f;
+        return item->type = JH_ITEM_MAP;
+    }
+    if (head >= 0x90 && head <= 0x9f) {
+        item->count = head & 0x0f;
+        return item->type = JH_ITEM_ARRAY;
+    }
+    if (head >= 0xa0 && head <= 0xbf) {
+        return jh_envelope_payload(reader, item, JH_ITEM_STRING, head & 0x1f);
+    }
+
+    switch (head) {
+    case 0xc0:
+        return item->type = JH_ITEM_NULL;
+    case 0xc2:
+    case 0xc3:
+        item->bool_value = 0xc3 == head;
+        return item->type = JH_ITEM_BOOL;
+    case 0xc4: case 0xc5: case 0xc6:
+        if (0 != jh_envelope_uint(reader, (size_t) 1 << (head - 0xc4), &arg)) return JH_ITEM_ERROR;
+        return jh_envelope_payload(reader, item, JH_ITEM_BYTES, arg);
+    case 0xca: case 0xcb: {
+        size_t width = 0xca == head ? 4 : 8;
+        if (0 != jh_envelope_uint(reader, width, &arg)) return JH_ITEM_ERROR;
+        item->double_value = jh_envelope_double(arg, width);
+        return item->type = JH_ITEM_DOUBLE;
+    }
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        if (0 != jh_envelope_uint(reader, (size_t) 1 << (head - 0xcc), &arg)) return JH_ITEM_ERROR;
+        if (arg > INT64_MAX) return JH_ITEM_ERROR;
+        item->int_value = (long long) arg;
+        return item->type = JH_ITEM_INT;
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+        size_t width = (size_t) 1 << (head - 0xd0);
+        if (0 != jh_envelope_uint(reader, width, &arg)) return JH_ITEM_ERROR;
+        // sign-extend
+        if (width < 8 && (arg >> (width * 8 - 1))) {
+            arg |= ~(uint64_t) 0 << (width * 8);
+        }
+        item->int_value = (long long) arg;
+        return item->type = JH_ITEM_INT;
+    }
+    case 0xd9: case 0xda: case 0xdb:
+        if (0 != jh_envelope_uint(reader, (size_t) 1 << (head - 0xd9), &arg)) return JH_ITEM_ERROR;
+        return jh_envelope_payload(reader, item, JH_ITEM_STRING, arg);
+    case 0xdc: case 0xdd:
+        if (0 != jh_envelope_uint(reader, 0xdc == head ? 2 : 4, &arg)) return JH_ITEM_ERROR;
+        item->count = (size_t) arg;
+        return item->type = JH_ITEM_ARRAY;
+    case 0xde: case 0xdf:
+        if (0 != jh_envelope_uint(reader, 0xde == head ? 2 : 4, &arg)) return JH_ITEM_ERROR;
+        item->count = (size_t) arg;
+        return item->type = JH_ITEM_MAP;
+    default:
+        return JH_ITEM_ERROR;
+    }
+}
+
+// returns item type, JH_ITEM_END at the end of input
+static inline int jh_envelope_read(jh_envelope_reader* reader, jh_envelope_item* item) {
+    memset(item, '\0', sizeof(jh_envelope_item));
+    if (reader->pos >= reader->end) {
+        return item->type = JH_ITEM_END;
+    }
+    if (JH_ENVELOPE_CBOR == reader->format) {
+        return item->type = jh_envelope_read_cbor(reader, item);
+    }
+    return item->type = jh_envelope_read_msgpack(reader, item);
+}
+
+// skips next value including all nested entries
+static inline int jh_envelope_skip(jh_envelope_reader* reader) {
+    jh_envelope_item item;
+    size_t left = 1;
+    while (left > 0) {
+        int type = jh_envelope_read(reader, &item);
+        if (JH_ITEM_ERROR == type || JH_ITEM_END == type) {
+            return -1;
+        }
+        left -= 1;
+        if (JH_ITEM_ARRAY == type) {
+            left += item.count;
+        } else if (JH_ITEM_MAP == type) {
+            left += item.count * 2;
+        }
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSON_HANDLER_ENVELOPE_H */
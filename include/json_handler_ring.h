@@ -0,0 +1,218 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_RING_H
+#define JSON_HANDLER_RING_H
+
+/*
+ * Shared memory transport for out-of-process handlers ('json_handler_ring'
+ * directive).
+ *
+ * On startup each nginx worker connects to the handler process over the
+ * specified unix socket and sends a 'jh_ring_hello' message with three file
+ * descriptors attached (SCM_RIGHTS): memfd with the shared segment, eventfd
+ * that is signalled when requests are written and eventfd that must be
+ * signalled by the handler after writing responses.
+ *
+ * Handler must keep the socket connection open while it serves the rings
+ * and must not write to it. When the connection is closed (or the ring
+ * is found corrupted) the worker fails all pending requests with 502 and
+ * reconnects in background with a new segment, increasing the delay
+ * between attempts up to 10 seconds. Requests that arrive while the
+ * worker is not connected are failed with 502 as well.
+ *
+ * Segment contains 'jh_ring_segment' header followed by request ring and
+ * response ring, both rings are single-producer/single-consumer. Request
+ * messages contain request envelopes in the configured format. Response
+ * messages have the following layout (host byte order):
+ *
+ *   uint64 handle, uint32 status, uint32 headers_count,
+ *   headers_count * (uint32 key_len, key, uint32 value_len, value),
+ *   uint32 body_len, body
+ *
+ * Response headers are passed to client as is (without 'X-Response-' prefix).
+ * Responses with handles of requests that are no longer pending (e.g. the
+ * client has gone) are dropped.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JH_RING_MAGIC 0x4e52484a
+#define JH_RING_VERSION 1
+#define JH_RING_CACHE_LINE 64
+
+typedef struct jh_ring_hello {
+    uint32_t magic;
+    uint32_t version;
+    int64_t pid;
+} jh_ring_hello;
+
+typedef struct jh_ring_segment {
+    uint32_t magic;
+    uint32_t version;
+    // data size of each ring, power of two
+    uint64_t ring_size;
+    char pad[JH_RING_CACHE_LINE - 16];
+} jh_ring_segment;
+
+typedef struct jh_ring {
+    // written by producer
+    uint64_t head;
+    char pad_head[JH_RING_CACHE_LINE - 8];
+    // written by consumer
+    uint64_t tail;
+    // set by consumer before sleeping on the doorbell
+    uint32_t waiting;
+    char pad_tail[JH_RING_CACHE_LINE - 12];
+} jh_ring;
+
+static inline size_t jh_ring_segment_size(uint64_t ring_size) {
+    return sizeof(jh_ring_segment) + 2 * (sizeof(jh_ring) + ring_size);
+}
+
+static inline jh_ring* jh_ring_request(jh_ring_segment* seg) {
+    return (jh_ring*) (seg + 1);
+}
+
+static inline jh_ring* jh_ring_response(jh_ring_segment* seg) {
+    return (jh_ring*) ((char*) jh_ring_request(seg) + sizeof(jh_ring) + seg->ring_size);
+}
+
+static inline void jh_ring_segment_init(jh_ring_segment* seg, uint64_t ring_size) {
+    memset(seg, '\0', jh_ring_segment_size(ring_size));
+    seg->magic = JH_RING_MAGIC;
+    seg->version = JH_RING_VERSION;
+    seg->ring_size = ring_size;
+}
+
+static inline void jh_ring_copy_in(jh_ring* ring, uint64_t size, uint64_t pos,
+        const void* data, size_t len) {
+    unsigned char* base = (unsigned char*) (ring + 1);
+    size_t off = (size_t) (pos & (size - 1));
+    size_t first = len < size - off ? len : (size_t) (size - off);
+    memcpy(base + off, data, first);
+    memcpy(base, (const unsigned char*) data + first, len - first);
+}
+
+static inline void jh_ring_copy_out(jh_ring* ring, uint64_t size, uint64_t pos,
+        void* data, size_t len) {
+    unsigned char* base = (unsigned char*) (ring + 1);
+    size_t off = (size_t) (pos & (size - 1));
+    size_t first = len < size - off ? len : (size_t) (size - off);
+    memcpy(data, base + off, first);
+    memcpy((unsigned char*) data + first, base, len - first);
+}
+
+/*
+ * Returns -1 if there is not enough space in ring (or the 'tail' written
+ * by consumer is out of range), 1 if consumer is waiting and its doorbell
+ * must be signalled, 0 otherwise.
+ */
+static inline int jh_ring_write(jh_ring* ring, uint64_t size, const void* data, uint32_t len) {
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t used = head - tail;
+    if (used > size || size - used < sizeof(uint32_t) + (uint64_t) len) {
+        return -1;
+    }
+    jh_ring_copy_in(ring, size, head, &len, sizeof(uint32_t));
+    jh_ring_copy_in(ring, size, head + sizeof(uint32_t), data, len);
+    __atomic_store_n(&ring->head, head + sizeof(uint32_t) + len, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) ? 1 : 0;
+}
+
+/*
+ * Returns 1 and length of the next message, 0 if ring is empty, -1 if
+ * 'head' or message length written by producer is out of range, ring
+ * cannot be used after that.
+ */
+static inline int jh_ring_peek(jh_ring* ring, uint64_t size, uint32_t* len) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    if (head == tail) {
+        return 0;
+    }
+    uint64_t used = head - tail;
+    if (used > size || used < sizeof(uint32_t)) {
+        return -1;
+    }
+    jh_ring_copy_out(ring, size, tail, len, sizeof(uint32_t));
+    if (sizeof(uint32_t) + (uint64_t) *len > used) {
+        return -1;
+    }
+    return 1;
+}
+
+// copies out the message returned by the last 'jh_ring_peek' call
+static inline void jh_ring_consume(jh_ring* ring, uint64_t size, void* data, uint32_t len) {
+    uint64_t tail = ring->tail;
+    jh_ring_copy_out(ring, size, tail + sizeof(uint32_t), data, len);
+    __atomic_store_n(&ring->tail, tail + sizeof(uint32_t) + len, __ATOMIC_RELEASE);
+}
+
+/*
+ * Consumer must call this before sleeping on the doorbell and sleep only
+ * if it returns 0 (ring is still empty), 'waiting' flag is cleared by the
+ * consumer after wake up.
+ */
+static inline int jh_ring_prepare_wait(jh_ring* ring) {
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail;
+}
+
+static inline void jh_ring_cancel_wait(jh_ring* ring) {
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+// response message reading
+
+typedef struct jh_ring_reader {
+    const char* pos;
+    const char* end;
+} jh_ring_reader;
+
+static inline int jh_ring_read_u32(jh_ring_reader* reader, uint32_t* val) {
+    if ((size_t) (reader->end - reader->pos) < sizeof(uint32_t)) {
+        return -1;
+    }
+    memcpy(val, reader->pos, sizeof(uint32_t));
+    reader->pos += sizeof(uint32_t);
+    return 0;
+}
+
+static inline int jh_ring_read_bytes(jh_ring_reader* reader, const char** data, uint32_t* len) {
+    if (0 != jh_ring_read_u32(reader, len)) {
+        return -1;
+    }
+    if ((size_t) (reader->end - reader->pos) < *len) {
+        return -1;
+    }
+    *data = reader->pos;
+    reader->pos += *len;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSON_HANDLER_RING_H */
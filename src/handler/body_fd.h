@@ -0,0 +1,26 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_BODY_FD_H
+#define JSON_HANDLER_BODY_FD_H
+
+// returns descriptor owned by the request, library must dup() it
+// to use it after the response is sent
+static ngx_fd_t body_fd_acquire(ngx_http_request_t* r) {
+    return r->request_body->temp_file->file.fd;
+}
+
+#endif /* JSON_HANDLER_BODY_FD_H */
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_COALESCE_H
+#define JSON_HANDLER_COALESCE_H
+
+// removes leader from in-flight tree and moves all its waiters
+// into the specified queue, waiter timers are cancelled
+static ngx_inline void coalesce_detach(json_handler_ctx_t* ctx, ngx_queue_t* waiters) {
+    ngx_queue_init(waiters);
+
+    if (NULL == ctx || !ctx->coalesce_leading) {
+        return;
+    }
+    ngx_rbtree_delete(ctx->coalesce_tree, &ctx->coalesce_node.node);
+    ctx->coalesce_leading = 0;
+
+    if (ngx_queue_empty(&ctx->coalesce_waiters)) {
+        return;
+    }
+    ngx_queue_add(waiters, &ctx->coalesce_waiters);
+    ngx_queue_init(&ctx->coalesce_waiters);
+    ctx->coalesce_waiters_count = 0;
+
+    for (ngx_queue_t* q = ngx_queue_head(waiters);
+            q != ngx_queue_sentinel(waiters);
+            q = ngx_queue_next(q)) {
+        json_handler_ctx_t* w = ngx_queue_data(q, json_handler_ctx_t, coalesce_queue);
+        w->coalesce_leader = NULL;
+        if (w->coalesce_timer.timer_set) {
+            ngx_del_timer(&w->coalesce_timer);
+        }
+    }
+}
+
+#endif /* JSON_HANDLER_COALESCE_H */
@@ -29,16 +29,26 @@
 #include <windows.h>
 
 #define dlsym GetProcAddress
+#define dlclose FreeLibrary
+
+static int dyload_filename(const char* libname, char* buf, size_t buf_len) {
+    // paths are used as is
+    int len_libname = NULL != strpbrk(libname, "/\\") ?
+            snprintf(buf, buf_len, "%s", libname) :
+            snprintf(buf, buf_len, "%s.dll", libname);
+    if (len_libname < 0 || len_libname >= buf_len) {
+        return -1;
+    }
+    return 0;
+}
 
 static void* dyload_platform(const char* libname) {
     char buf[1024];
-
-    int len_libname = snprintf(buf, sizeof(buf), "%s.dll", libname);
-    if (len_libname < 0 || len_libname >= sizeof(buf)) {
+    if (0 != dyload_filename(libname, buf, sizeof(buf))) {
         return NULL;
     }
 
-    // note: LoadLibraryW should not be necessary because only name is used
+    // note: LoadLibraryW should not be necessary for ASCII names and paths
     HANDLE lib = LoadLibraryA(buf);
     if (NULL == lib) {
         return NULL;
@@ -47,19 +57,37 @@ static void* dyload_platform(const char* libname) {
     return lib;
 }
 
+static int dyload_resident_platform(const char* libname) {
+    char buf[1024];
+    if (0 != dyload_filename(libname, buf, sizeof(buf))) {
+        return 0;
+    }
+    return NULL != GetModuleHandleA(buf);
+}
+
 #else // !_WIN32
 
 #include <dlfcn.h>
 
+static int dyload_filename(const char* libname, char* buf, size_t buf_len) {
+    // paths are used as is
+    int len_libname = NULL != strchr(libname, '/') ?
+            snprintf(buf, buf_len, "%s", libname) :
+            snprintf(buf, buf_len, "lib%s.so", libname);
+    if (len_libname < 0 || len_libname >= (int) buf_len) {
+        return -1;
+    }
+    return 0;
+}
+
 static void* dyload_platform(const char* libname) {
     char buf[1024];
-
-    int len_libname = snprintf(buf, sizeof(buf), "lib%s.so", libname);
-    if (len_libname < 0 || len_libname >= (int) sizeof(buf)) {
+    if (0 != dyload_filename(libname, buf, sizeof(buf))) {
         return NULL;
     }
 
-    void* lib = dlopen(buf, RTLD_LAZY);
+    // symbols are resolved at load time instead of on first call
+    void* lib = dlopen(buf, RTLD_NOW);
     if (NULL == lib) {
         return NULL;
     }
@@ -67,6 +95,19 @@ static void* dyload_platform(const char* libname) {
     return lib;
 }
 
+static int dyload_resident_platform(const char* libname) {
+    char buf[1024];
+    if (0 != dyload_filename(libname, buf, sizeof(buf))) {
+        return 0;
+    }
+    void* lib = dlopen(buf, RTLD_NOW | RTLD_NOLOAD);
+    if (NULL == lib) {
+        return 0;
+    }
+    dlclose(lib);
+    return 1;
+}
+
 #endif // _WIN32
 
 static void* dyload_library(const char* libname) {
@@ -86,4 +127,20 @@ static void* dyload_symbol(void* lib, const char* symbol) {
     return dlsym(lib, symbol);
 }
 
+static void dyload_close(void* lib) {
+    if (NULL != lib) {
+        dlclose(lib);
+    }
+}
+
+// returns 1 if the library is mapped into the process, libraries
+// that cannot be unloaded (e.g. Rust cdylib with thread-local destructors)
+// stay mapped after the last 'dyload_close'
+static int dyload_resident(const char* libname) {
+    if (NULL == libname) {
+        return 0;
+    }
+    return dyload_resident_platform(libname);
+}
+
 #endif /* JSON_HANDLER_DYLOAD_H */
\ No newline at end of file
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_ENVELOPE_WRITER_H
+#define JSON_HANDLER_ENVELOPE_WRITER_H
+
+// binary request envelope writer, CBOR (RFC 8949) and MessagePack,
+// only the subset of types that is needed for jansson values and raw bytes
+
+#define ENVELOPE_JSON 0
+#define ENVELOPE_CBOR 1
+#define ENVELOPE_MSGPACK 2
+
+typedef struct envelope_s {
+    int format;
+    unsigned char* buf;
+    size_t len;
+    size_t cap;
+    int failed;
+} envelope_t;
+
+static void envelope_init(envelope_t* env, int format) {
+    memset(env, '\0', sizeof(envelope_t));
+    env->format = format;
+}
+
+static void envelope_free(envelope_t* env) {
+    free(env->buf);
+    env->buf = NULL;
+    env->len = 0;
+    env->cap = 0;
+}
+
+static unsigned char* envelope_reserve(envelope_t* env, size_t len) {
+    if (env->failed) {
+        return NULL;
+    }
+    if (env->len + len > env->cap) {
+        size_t cap = 0 == env->cap ? 1024 : env->cap * 2;
+        while (cap < env->len + len) {
+            cap *= 2;
+        }
+        unsigned char* buf = realloc(env->buf, cap);
+        if (NULL == buf) {
+            env->failed = 1;
+            return NULL;
+        }
+        env->buf = buf;
+        env->cap = cap;
+    }
+    unsigned char* res = env->buf + env->len;
+    env->len += len;
+    return res;
+}
+
+static void envelope_write(envelope_t* env, const void* data, size_t len) {
+    unsigned char* dest = envelope_reserve(env, len);
+    if (NULL != dest && len > 0) {
+        memcpy(dest, data, len);
+    }
+}
+
+static void envelope_byte(envelope_t* env, unsigned char byte) {
+    envelope_write(env, &byte, 1);
+}
+
+// big-endian, width is 1, 2, 4 or 8
+static void envelope_uint(envelope_t* env, uint64_t val, size_t width) {
+    unsigned char* dest = envelope_reserve(env, width);
+    if (NULL == dest) {
+        return;
+    }
+    for (size_t i = 0; i < width; i++) {
+        dest[width - 1 - i] = (unsigned char) (val >> (i * 8));
+    }
+}
+
+static void envelope_cbor_head(envelope_t* env, unsigned char major, uint64_t val) {
+    major = (unsigned char) (major << 5);
+    if (val < 24) {
+        envelope_byte(env, major | (unsigned char) val);
+    } else if (val <= 0xff) {
+        envelope_byte(env, major | 24);
+        envelope_uint(env, val, 1);
+    } else if (val <= 0xffff) {
+        envelope_byte(env, major | 25);
+        envelope_uint(env, val, 2);
+    } else if (val <= 0xffffffff) {
+        envelope_byte(env, major | 26);
+        envelope_uint(env, val, 4);
+    } else {
+        envelope_byte(env, major | 27);
+        envelope_uint(env, val, 8);
+    }
+}
+
+// str8/bin8 and their 16/32 bit forms, fixed-size forms are handled by callers
+static void envelope_msgpack_head(envelope_t* env, unsigned char code8, uint64_t val) {
+    if (val <= 0xff) {
+        envelope_byte(env, code8);
+        envelope_uint(env, val, 1);
+    } else if (val <= 0xffff) {
+        envelope_byte(env, (unsigned char) (code8 + 1));
+        envelope_uint(env, val, 2);
+    } else {
+        envelope_byte(env, (unsigned char) (code8 + 2));
+        envelope_uint(env, val, 4);
+    }
+}
+
+static void envelope_map(envelope_t* env, size_t count) {
+    if (ENVELOPE_CBOR == env->format) {
+        envelope_cbor_head(env, 5, count);
+    } else if (count < 16) {
+        envelope_byte(env, (unsigned char) (0x80 | count));
+    } else if (count <= 0xffff) {
+        envelope_byte(env, 0xde);
+        envelope_uint(env, count, 2);
+    } else {
+        envelope_byte(env, 0xdf);
+        envelope_uint(env, count, 4);
+    }
+}
+
+static void envelope_array(envelope_t* env, size_t count) {
+    if (ENVELOPE_CBOR == env->format) {
+        envelope_cbor_head(env, 4, count);
+    } else if (count < 16) {
+        envelope_byte(env, (unsigned char) (0x90 | count));
+    } else if (count <= 0xffff) {
+        envelope_byte(env, 0xdc);
+        envelope_uint(env, count, 2);
+    } else {
+        envelope_byte(env, 0xdd);
+        envelope_uint(env, count, 4);
+    }
+}
+
+static void envelope_string(envelope_t* env, const char* str, size_t len) {
+    if (ENVELOPE_CBOR == env->format) {
+        envelope_cbor_head(env, 3, len);
+    } else if (len < 32) {
+        envelope_byte(env, (unsigned char) (0xa0 | len));
+    } else {
+        envelope_msgpack_head(env, 0xd9, len);
+    }
+    envelope_write(env, str, len);
+}
+
+static void envelope_cstring(envelope_t* env, const char* str) {
+    envelope_string(env, str, strlen(str));
+}
+
+static void envelope_bytes(envelope_t* env, const unsigned char* data, size_t len) {
+    if (ENVELOPE_CBOR == env->format) {
+        envelope_cbor_head(env, 2, len);
+    } else {
+        envelope_msgpack_head(env, 0xc4, len);
+    }
+    envelope_write(env, data, len);
+}
+
+static void envelope_int(envelope_t* env, long long val) {
+    if (ENVELOPE_CBOR == env->format) {
+        if (val >= 0) {
+            envelope_cbor_head(env, 0, (uint64_t) val);
+        } else {
+            envelope_cbor_head(env, 1, (uint64_t) (-(val + 1)));
+        }
+    } else if (val >= 0 && val < 128) {
+        envelope_byte(env, (unsigned char) val);
+    } else if (val < 0 && val >= -32) {
+        envelope_byte(env, (unsigned char) (0xe0 | (val + 32)));
+    } else if (val >= 0) {
+        envelope_byte(env, 0xcf);
+        envelope_uint(env, (uint64_t) val, 8);
+    } else {
+        envelope_byte(env, 0xd3);
+        envelope_uint(env, (uint64_t) val, 8);
+    }
+}
+
+static void envelope_double(envelope_t* env, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    envelope_byte(env, ENVELOPE_CBOR == env->format ? 0xfb : 0xcb);
+    envelope_uint(env, bits, 8);
+}
+
+static void envelope_bool(envelope_t* env, int val) {
+    if (ENVELOPE_CBOR == env->format) {
+        envelope_byte(env, val ? 0xf5 : 0xf4);
+    } else {
+        envelope_byte(env, val ? 0xc3 : 0xc2);
+    }
+}
+
+static void envelope_null(envelope_t* env) {
+    envelope_byte(env, ENVELOPE_CBOR == env->format ? 0xf6 : 0xc0);
+}
+
+static void envelope_json(envelope_t* env, json_t* json) {
+    if (NULL == json) {
+        envelope_null(env);
+        return;
+    }
+    switch (json_typeof(json)) {
+    case JSON_OBJECT: {
+        envelope_map(env, json_object_size(json));
+        for (void* it = json_object_iter(json); NULL != it; it = json_object_iter_next(json, it)) {
+            envelope_cstring(env, json_object_iter_key(it));
+            envelope_json(env, json_object_iter_value(it));
+        }
+        break;
+    }
+    case JSON_ARRAY: {
+        size_t size = json_array_size(json);
+        envelope_array(env, size);
+        for (size_t i = 0; i < size; i++) {
+            envelope_json(env, json_array_get(json, i));
+        }
+        break;
+    }
+    case JSON_STRING:
+        envelope_string(env, json_string_value(json), json_string_length(json));
+        break;
+    case JSON_INTEGER:
+        envelope_int(env, json_integer_value(json));
+        break;
+    case JSON_REAL:
+        envelope_double(env, json_real_value(json));
+        break;
+    case JSON_TRUE:
+        envelope_bool(env, 1);
+        break;
+    case JSON_FALSE:
+        envelope_bool(env, 0);
+        break;
+    default:
+        envelope_null(env);
+    }
+}
+
+#endif /* JSON_HANDLER_ENVELOPE_WRITER_H */
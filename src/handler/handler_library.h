@@ -0,0 +1,106 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_HANDLER_LIBRARY_H
+#define JSON_HANDLER_HANDLER_LIBRARY_H
+
+typedef int (*submit_json_request_type)(const char*);
+typedef int (*submit_binary_request_type)(const char*, size_t);
+typedef int (*handle_json_request_sync_type)(const char*, json_handler_response*);
+typedef int (*init_json_handler_type)(const json_handler_api*);
+typedef int (*warmup_json_handler_type)();
+typedef void (*receive_subrequest_response_type)(const char*);
+typedef void (*shutdown_json_handler_type)();
+
+// loaded version of the handler library, old versions are kept
+// loaded after hot reload until their in-flight requests are finished
+typedef struct handler_library_s handler_library_t;
+
+struct handler_library_s {
+    void* lib;
+    submit_json_request_type submit_json_request;
+    handle_json_request_sync_type handle_json_request_sync;
+    submit_binary_request_type submit_binary_request;
+    receive_subrequest_response_type receive_subrequest_response;
+    shutdown_json_handler_type shutdown_json_handler;
+    ngx_uint_t inflight;
+    ngx_queue_t queue;
+    unsigned retired:1;
+};
+
+// all versions that are still mapped, including retired ones
+static ngx_queue_t handler_libraries;
+
+static void handler_library_register(handler_library_t* hl) {
+    ngx_queue_insert_tail(&handler_libraries, &hl->queue);
+}
+
+// dlopen returns the same handle for a file (or a link to it)
+// that is already loaded
+static handler_library_t* handler_library_find(void* lib) {
+    for (ngx_queue_t* q = ngx_queue_head(&handler_libraries);
+            q != ngx_queue_sentinel(&handler_libraries);
+            q = ngx_queue_next(q)) {
+        handler_library_t* hl = ngx_queue_data(q, handler_library_t, queue);
+        if (hl->lib == lib) {
+            return hl;
+        }
+    }
+    return NULL;
+}
+
+static void handler_library_unload(handler_library_t* hl, ngx_log_t* log) {
+    // library threads may still run its code without an explicit shutdown
+    if (NULL != hl->shutdown_json_handler) {
+        hl->shutdown_json_handler();
+        dyload_close(hl->lib);
+        ngx_log_error(NGX_LOG_NOTICE, log, 0, "Retired handler library unloaded");
+        ngx_queue_remove(&hl->queue);
+        ngx_free(hl);
+    } else {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                "Retired handler library does not export 'shutdown_json_handler', kept loaded");
+    }
+}
+
+static void handler_library_retire(handler_library_t* hl, ngx_log_t* log) {
+    hl->retired = 1;
+    if (0 == hl->inflight) {
+        handler_library_unload(hl, log);
+    }
+}
+
+static void handler_library_release(void* data) {
+    handler_library_t* hl = data;
+    hl->inflight -= 1;
+    if (hl->retired && 0 == hl->inflight) {
+        handler_library_unload(hl, ngx_cycle->log);
+    }
+}
+
+// library is released when request pool is destroyed
+static ngx_int_t handler_library_acquire(handler_library_t* hl, ngx_http_request_t* r) {
+    ngx_pool_cleanup_t* cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (NULL == cln) {
+        return NGX_ERROR;
+    }
+    cln->handler = handler_library_release;
+    cln->data = hl;
+    hl->inflight += 1;
+    return NGX_OK;
+}
+
+#endif /* JSON_HANDLER_HANDLER_LIBRARY_H */
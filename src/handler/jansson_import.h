@@ -64,6 +64,24 @@ const char* json_string_value(const json_t* string) {
     return json_string_value_fun(string);
 }
 
+typedef size_t (*json_string_length_type)(const json_t*);
+static json_string_length_type json_string_length_fun = NULL;
+size_t json_string_length(const json_t* string) {
+    return json_string_length_fun(string);
+}
+
+typedef json_int_t (*json_integer_value_type)(const json_t*);
+static json_integer_value_type json_integer_value_fun = NULL;
+json_int_t json_integer_value(const json_t* integer) {
+    return json_integer_value_fun(integer);
+}
+
+typedef double (*json_real_value_type)(const json_t*);
+static json_real_value_type json_real_value_fun = NULL;
+double json_real_value(const json_t* real) {
+    return json_real_value_fun(real);
+}
+
 // object
 
 typedef int (*json_object_set_new_type)(json_t*, const char*, json_t*);
@@ -72,6 +90,50 @@ int json_object_set_new(json_t* object, const char* key, json_t* value) {
     return json_object_set_new_fun(object, key, value);
 }
 
+typedef size_t (*json_object_size_type)(const json_t*);
+static json_object_size_type json_object_size_fun = NULL;
+size_t json_object_size(const json_t* object) {
+    return json_object_size_fun(object);
+}
+
+typedef void* (*json_object_iter_type)(json_t*);
+static json_object_iter_type json_object_iter_fun = NULL;
+void* json_object_iter(json_t* object) {
+    return json_object_iter_fun(object);
+}
+
+typedef void* (*json_object_iter_next_type)(json_t*, void*);
+static json_object_iter_next_type json_object_iter_next_fun = NULL;
+void* json_object_iter_next(json_t* object, void* iter) {
+    return json_object_iter_next_fun(object, iter);
+}
+
+typedef const char* (*json_object_iter_key_type)(void*);
+static json_object_iter_key_type json_object_iter_key_fun = NULL;
+const char* json_object_iter_key(void* iter) {
+    return json_object_iter_key_fun(iter);
+}
+
+typedef json_t* (*json_object_iter_value_type)(void*);
+static json_object_iter_value_type json_object_iter_value_fun = NULL;
+json_t* json_object_iter_value(void* iter) {
+    return json_object_iter_value_fun(iter);
+}
+
+// array
+
+typedef size_t (*json_array_size_type)(const json_t*);
+static json_array_size_type json_array_size_fun = NULL;
+size_t json_array_size(const json_t* array) {
+    return json_array_size_fun(array);
+}
+
+typedef json_t* (*json_array_get_type)(const json_t*, size_t);
+static json_array_get_type json_array_get_fun = NULL;
+json_t* json_array_get(const json_t* array, size_t index) {
+    return json_array_get_fun(array, index);
+}
+
 // serialization
 
 typedef json_t* (*json_loadb_type)(const char*, size_t, size_t, json_error_t*);
@@ -95,7 +157,12 @@ void json_delete(json_t* json) {
     json_delete_fun(json);
 }
 
+// loaded in master process, workers inherit resolved symbols
+static void* jansson_library = NULL;
+
 static int jansson_initialize() {
+    if (NULL != jansson_library) return 0;
+
     void* lib = dyload_library("jansson");
     if (NULL == lib) return -1;
 
@@ -112,9 +179,30 @@ static int jansson_initialize() {
 
     json_string_value_fun = dyload_symbol(lib, "json_string_value");
     if (NULL == json_string_value_fun) return -1;
+    json_string_length_fun = dyload_symbol(lib, "json_string_length");
+    if (NULL == json_string_length_fun) return -1;
+    json_integer_value_fun = dyload_symbol(lib, "json_integer_value");
+    if (NULL == json_integer_value_fun) return -1;
+    json_real_value_fun = dyload_symbol(lib, "json_real_value");
+    if (NULL == json_real_value_fun) return -1;
 
     json_object_set_new_fun = dyload_symbol(lib, "json_object_set_new");
     if (NULL == json_object_set_new_fun) return -1;
+    json_object_size_fun = dyload_symbol(lib, "json_object_size");
+    if (NULL == json_object_size_fun) return -1;
+    json_object_iter_fun = dyload_symbol(lib, "json_object_iter");
+    if (NULL == json_object_iter_fun) return -1;
+    json_object_iter_next_fun = dyload_symbol(lib, "json_object_iter_next");
+    if (NULL == json_object_iter_next_fun) return -1;
+    json_object_iter_key_fun = dyload_symbol(lib, "json_object_iter_key");
+    if (NULL == json_object_iter_key_fun) return -1;
+    json_object_iter_value_fun = dyload_symbol(lib, "json_object_iter_value");
+    if (NULL == json_object_iter_value_fun) return -1;
+
+    json_array_size_fun = dyload_symbol(lib, "json_array_size");
+    if (NULL == json_array_size_fun) return -1;
+    json_array_get_fun = dyload_symbol(lib, "json_array_get");
+    if (NULL == json_array_get_fun) return -1;
 
     json_loadb_fun = dyload_symbol(lib, "json_loadb");
     if (NULL == json_loadb_fun) return -1;
@@ -124,6 +212,7 @@ static int jansson_initialize() {
     json_delete_fun = dyload_symbol(lib, "json_delete");
     if (NULL == json_delete_fun) return -1;
 
+    jansson_library = lib;
     return 0;
 }
 
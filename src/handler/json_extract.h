@@ -0,0 +1,328 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_JSON_EXTRACT_H
+#define JSON_HANDLER_JSON_EXTRACT_H
+
+// locates values referenced by JSON Pointers (RFC 6901) in raw JSON text
+// without building a document, members on the path are skipped over,
+// scanning stops at the referenced value; input is expected to be
+// already checked with json_validator, which accepts duplicate keys,
+// so objects on the path are scanned to the end to reject them the
+// same way as the parser does
+
+// index tokens longer than this never match
+#define JSON_EXTRACT_MAX_INDEX_LEN 18
+
+#define JSON_EXTRACT_NOT_FOUND -1
+#define JSON_EXTRACT_DUPLICATE -2
+
+typedef struct json_pointer_token_s {
+    // unescaped
+    const char* data;
+    size_t len;
+} json_pointer_token_t;
+
+static const char* je_ws(const char* p, const char* end) {
+    while (p < end && (' ' == *p || '\t' == *p || '\n' == *p || '\r' == *p)) {
+        p++;
+    }
+    return p;
+}
+
+// 'p' points to opening quote, returns pointer past closing quote
+static const char* je_skip_string(const char* p, const char* end) {
+    for (p++; p < end; p++) {
+        if ('\\' == *p) {
+            p++;
+        } else if ('"' == *p) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// returns pointer past the value
+static const char* je_skip_value(const char* p, const char* end) {
+    if (p >= end) {
+        return NULL;
+    }
+    if ('"' == *p) {
+        return je_skip_string(p, end);
+    }
+    if ('{' == *p || '[' == *p) {
+        size_t depth = 0;
+        while (p < end) {
+            if ('"' == *p) {
+                p = je_skip_string(p, end);
+                if (NULL == p) {
+                    return NULL;
+                }
+                continue;
+            }
+            if ('{' == *p || '[' == *p) {
+                depth++;
+            } else if ('}' == *p || ']' == *p) {
+                depth--;
+                if (0 == depth) {
+                    return p + 1;
+                }
+            }
+            p++;
+        }
+        return NULL;
+    }
+    // literal or number
+    const char* start = p;
+    while (p < end && ',' != *p && '}' != *p && ']' != *p &&
+            ' ' != *p && '\t' != *p && '\n' != *p && '\r' != *p) {
+        p++;
+    }
+    return p != start ? p : NULL;
+}
+
+static int je_hex4(const char* p, const char* end, unsigned int* res) {
+    if (end - p < 4) {
+        return -1;
+    }
+    *res = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        unsigned int digit;
+        if (c >= '0' && c <= '9') {
+            digit = (unsigned int) (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (unsigned int) (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (unsigned int) (c - 'A' + 10);
+        } else {
+            return -1;
+        }
+        *res = (*res << 4) | digit;
+    }
+    return 0;
+}
+
+static size_t je_utf8(unsigned int cp, char* buf) {
+    if (cp < 0x80) {
+        buf[0] = (char) cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        buf[0] = (char) (0xc0 | (cp >> 6));
+        buf[1] = (char) (0x80 | (cp & 0x3f));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        buf[0] = (char) (0xe0 | (cp >> 12));
+        buf[1] = (char) (0x80 | ((cp >> 6) & 0x3f));
+        buf[2] = (char) (0x80 | (cp & 0x3f));
+        return 3;
+    }
+    buf[0] = (char) (0xf0 | (cp >> 18));
+    buf[1] = (char) (0x80 | ((cp >> 12) & 0x3f));
+    buf[2] = (char) (0x80 | ((cp >> 6) & 0x3f));
+    buf[3] = (char) (0x80 | (cp & 0x3f));
+    return 4;
+}
+
+// compares raw (escaped) object key with unescaped token
+static int je_key_equals(const char* key, const char* key_end, const json_pointer_token_t* tok) {
+    const char* t = tok->data;
+    const char* t_end = tok->data + tok->len;
+    const char* p = key;
+    while (p < key_end) {
+        char buf[4];
+        size_t len = 1;
+        if ('\\' != *p) {
+            buf[0] = *p;
+            p++;
+        } else {
+            p++;
+            if (p >= key_end) {
+                return 0;
+            }
+            char c = *p++;
+            switch (c) {
+            case 'b': buf[0] = '\b'; break;
+            case 'f': buf[0] = '\f'; break;
+            case 'n': buf[0] = '\n'; break;
+            case 'r': buf[0] = '\r'; break;
+            case 't': buf[0] = '\t'; break;
+            case 'u': {
+                unsigned int cp;
+                if (0 != je_hex4(p, key_end, &cp)) {
+                    return 0;
+                }
+                p += 4;
+                // surrogate pair
+                if (cp >= 0xd800 && cp <= 0xdbff && key_end - p >= 6 && '\\' == p[0] && 'u' == p[1]) {
+                    unsigned int low;
+                    if (0 == je_hex4(p + 2, key_end, &low) && low >= 0xdc00 && low <= 0xdfff) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    }
+                }
+                len = je_utf8(cp, buf);
+                break;
+            }
+            default: buf[0] = c; // quote, slashes
+            }
+        }
+        if ((size_t) (t_end - t) < len || 0 != memcmp(t, buf, len)) {
+            return 0;
+        }
+        t += len;
+    }
+    return t == t_end;
+}
+
+// returns -1 for tokens that are not array indices
+static long long je_index(const json_pointer_token_t* tok) {
+    if (0 == tok->len || tok->len > JSON_EXTRACT_MAX_INDEX_LEN || ('0' == tok->data[0] && tok->len > 1)) {
+        return -1;
+    }
+    long long res = 0;
+    for (size_t i = 0; i < tok->len; i++) {
+        char c = tok->data[i];
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        res = res * 10 + (c - '0');
+    }
+    return res;
+}
+
+// 'p' points to the value of the matched member, returns 1 if
+// the same key appears again in the rest of the object
+static int je_key_repeated(const char* p, const char* end, const json_pointer_token_t* tok) {
+    for (;;) {
+        p = je_skip_value(p, end);
+        if (NULL == p) {
+            return 0;
+        }
+        p = je_ws(p, end);
+        if (p >= end || ',' != *p) { // end of object
+            return 0;
+        }
+        p = je_ws(p + 1, end);
+        if (p >= end || '"' != *p) {
+            return 0;
+        }
+        const char* key = p + 1;
+        p = je_skip_string(p, end);
+        if (NULL == p) {
+            return 0;
+        }
+        if (je_key_equals(key, p - 1, tok)) {
+            return 1;
+        }
+        p = je_ws(p, end);
+        if (p >= end || ':' != *p) {
+            return 0;
+        }
+        p = je_ws(p + 1, end);
+    }
+}
+
+// returns 0 and referenced value bounds, JSON_EXTRACT_NOT_FOUND if value
+// is not found, JSON_EXTRACT_DUPLICATE if a key on the path is not unique
+static int json_extract(const char* data, size_t len, const json_pointer_token_t* tokens, size_t count,
+        const char** value, size_t* value_len) {
+    const char* p = data;
+    const char* end = data + len;
+
+    for (size_t i = 0; i < count; i++) {
+        const json_pointer_token_t* tok = &tokens[i];
+        p = je_ws(p, end);
+        if (p >= end) {
+            return JSON_EXTRACT_NOT_FOUND;
+        }
+
+        if ('{' == *p) {
+            p++;
+            for (;;) {
+                p = je_ws(p, end);
+                if (p >= end || '"' != *p) { // end of object, not found
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                const char* key = p + 1;
+                p = je_skip_string(p, end);
+                if (NULL == p) {
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                const char* key_end = p - 1;
+                p = je_ws(p, end);
+                if (p >= end || ':' != *p) {
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                p = je_ws(p + 1, end);
+                if (je_key_equals(key, key_end, tok)) {
+                    if (je_key_repeated(p, end, tok)) {
+                        return JSON_EXTRACT_DUPLICATE;
+                    }
+                    break;
+                }
+                p = je_skip_value(p, end);
+                if (NULL == p) {
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                p = je_ws(p, end);
+                if (p >= end || ',' != *p) {
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                p++;
+            }
+        } else if ('[' == *p) {
+            long long idx = je_index(tok);
+            if (idx < 0) {
+                return JSON_EXTRACT_NOT_FOUND;
+            }
+            p++;
+            for (long long j = 0; /* void */; j++) {
+                p = je_ws(p, end);
+                if (p >= end || ']' == *p) { // index out of range
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                if (j == idx) {
+                    break;
+                }
+                p = je_skip_value(p, end);
+                if (NULL == p) {
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                p = je_ws(p, end);
+                if (p >= end || ',' != *p) {
+                    return JSON_EXTRACT_NOT_FOUND;
+                }
+                p++;
+            }
+        } else { // scalar on the path
+            return JSON_EXTRACT_NOT_FOUND;
+        }
+    }
+
+    p = je_ws(p, end);
+    const char* value_end = je_skip_value(p, end);
+    if (NULL == value_end) {
+        return JSON_EXTRACT_NOT_FOUND;
+    }
+    *value = p;
+    *value_len = (size_t) (value_end - p);
+    return 0;
+}
+
+#endif /* JSON_HANDLER_JSON_EXTRACT_H */
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_JSON_VALIDATOR_H
+#define JSON_HANDLER_JSON_VALIDATOR_H
+
+// resumable syntax checker, input can be fed in arbitrary chunks,
+// any top-level value is accepted (RFC 8259), whether it is passed
+// as a json or as a string is decided by the parser
+
+// same as JSON_PARSER_MAX_DEPTH in jansson
+#define JSON_VALIDATOR_MAX_DEPTH 2048
+
+enum {
+    JV_START,
+    JV_VALUE,
+    JV_ARRAY_FIRST,
+    JV_OBJECT_FIRST,
+    JV_KEY,
+    JV_COLON,
+    JV_AFTER,
+    JV_DONE,
+    JV_STRING,
+    JV_ESCAPE,
+    JV_UNICODE,
+    JV_LITERAL,
+    JV_NUM_MINUS,
+    JV_NUM_ZERO,
+    JV_NUM_INT,
+    JV_NUM_DOT,
+    JV_NUM_FRAC,
+    JV_NUM_EXP,
+    JV_NUM_EXP_SIGN,
+    JV_NUM_EXP_DIGITS,
+    JV_ERROR
+};
+
+typedef struct json_validator_s json_validator_t;
+
+struct json_validator_s {
+    int state;
+    int string_is_key;
+    const char* literal;
+    size_t literal_pos;
+    int unicode_left;
+    size_t depth;
+    // one bit per level, set for objects
+    unsigned char stack[JSON_VALIDATOR_MAX_DEPTH / 8];
+};
+
+static void json_validator_init(json_validator_t* v) {
+    memset(v, '\0', sizeof(json_validator_t));
+    v->state = JV_START;
+}
+
+static int jv_is_ws(unsigned char c) {
+    return ' ' == c || '\t' == c || '\n' == c || '\r' == c;
+}
+
+static int jv_is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int jv_is_hex(unsigned char c) {
+    return jv_is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static int jv_top_is_object(json_validator_t* v) {
+    size_t idx = v->depth - 1;
+    return 0 != (v->stack[idx / 8] & (1 << (idx % 8)));
+}
+
+static void jv_value_done(json_validator_t* v) {
+    v->state = 0 == v->depth ? JV_DONE : JV_AFTER;
+}
+
+static void jv_push(json_validator_t* v, int is_object) {
+    if (v->depth >= JSON_VALIDATOR_MAX_DEPTH) {
+        v->state = JV_ERROR;
+        return;
+    }
+    size_t idx = v->depth;
+    if (is_object) {
+        v->stack[idx / 8] |= (unsigned char) (1 << (idx % 8));
+        v->state = JV_OBJECT_FIRST;
+    } else {
+        v->stack[idx / 8] &= (unsigned char) ~(1 << (idx % 8));
+        v->state = JV_ARRAY_FIRST;
+    }
+    v->depth += 1;
+}
+
+static void jv_pop(json_validator_t* v, int is_object) {
+    if (0 == v->depth || is_object != jv_top_is_object(v)) {
+        v->state = JV_ERROR;
+        return;
+    }
+    v->depth -= 1;
+    jv_value_done(v);
+}
+
+static void jv_begin_literal(json_validator_t* v, const char* literal) {
+    v->literal = literal;
+    v->literal_pos = 1;
+    v->state = JV_LITERAL;
+}
+
+static void jv_begin_value(json_validator_t* v, unsigned char c) {
+    switch (c) {
+    case '{': jv_push(v, 1); break;
+    case '[': jv_push(v, 0); break;
+    case '"': v->string_is_key = 0; v->state = JV_STRING; break;
+    case '-': v->state = JV_NUM_MINUS; break;
+    case '0': v->state = JV_NUM_ZERO; break;
+    case 't': jv_begin_literal(v, "true"); break;
+    case 'f': jv_begin_literal(v, "false"); break;
+    case 'n': jv_begin_literal(v, "null"); break;
+    default:
+        v->state = jv_is_digit(c) ? JV_NUM_INT : JV_ERROR;
+    }
+}
+
+static void jv_step(json_validator_t* v, unsigned char c);
+
+static void jv_end_number(json_validator_t* v, unsigned char c) {
+    jv_value_done(v);
+    // delimiter belongs to the enclosing container
+    jv_step(v, c);
+}
+
+static void jv_step(json_validator_t* v, unsigned char c) {
+    switch (v->state) {
+    case JV_START:
+    case JV_VALUE:
+        if (jv_is_ws(c)) break;
+        jv_begin_value(v, c);
+        break;
+    case JV_ARRAY_FIRST:
+        if (jv_is_ws(c)) break;
+        if (']' == c) {
+            jv_pop(v, 0);
+        } else {
+            jv_begin_value(v, c);
+        }
+        break;
+    case JV_OBJECT_FIRST:
+    case JV_KEY:
+        if (jv_is_ws(c)) break;
+        if ('"' == c) {
+            v->string_is_key = 1;
+            v->state = JV_STRING;
+        } else if ('}' == c && JV_OBJECT_FIRST == v->state) {
+            jv_pop(v, 1);
+        } else {
+            v->state = JV_ERROR;
+        }
+        break;
+    case JV_COLON:
+        if (jv_is_ws(c)) break;
+        v->state = ':' == c ? JV_VALUE : JV_ERROR;
+        break;
+    case JV_AFTER:
+        if (jv_is_ws(c)) break;
+        if (',' == c) {
+            v->state = jv_top_is_object(v) ? JV_KEY : JV_VALUE;
+        } else if ('}' == c) {
+            jv_pop(v, 1);
+        } else if (']' == c) {
+            jv_pop(v, 0);
+        } else {
+            v->state = JV_ERROR;
+        }
+        break;
+    case JV_DONE:
+        if (!jv_is_ws(c)) {
+            v->state = JV_ERROR;
+        }
+        break;
+    case JV_STRING:
+        if ('"' == c) {
+            if (v->string_is_key) {
+                v->state = JV_COLON;
+            } else {
+                jv_value_done(v);
+            }
+        } else if ('\\' == c) {
+            v->state = JV_ESCAPE;
+        } else if (c < 0x20) {
+            v->state = JV_ERROR;
+        }
+        break;
+    case JV_ESCAPE:
+        if ('u' == c) {
+            v->unicode_left = 4;
+            v->state = JV_UNICODE;
+        } else if (NULL != strchr("\"\\/bfnrt", c) && '\0' != c) {
+            v->state = JV_STRING;
+        } else {
+            v->state = JV_ERROR;
+        }
+        break;
+    case JV_UNICODE:
+        if (!jv_is_hex(c)) {
+            v->state = JV_ERROR;
+        } else if (0 == --v->unicode_left) {
+            v->state = JV_STRING;
+        }
+        break;
+    case JV_LITERAL:
+        if (c != (unsigned char) v->literal[v->literal_pos]) {
+            v->state = JV_ERROR;
+        } else if ('\0' == v->literal[++v->literal_pos]) {
+            jv_value_done(v);
+        }
+        break;
+    case JV_NUM_MINUS:
+        if ('0' == c) {
+            v->state = JV_NUM_ZERO;
+        } else {
+            v->state = jv_is_digit(c) ? JV_NUM_INT : JV_ERROR;
+        }
+        break;
+    case JV_NUM_ZERO:
+    case JV_NUM_INT:
+        if (jv_is_digit(c) && JV_NUM_INT == v->state) break;
+        if ('.' == c) {
+            v->state = JV_NUM_DOT;
+        } else if ('e' == c || 'E' == c) {
+            v->state = JV_NUM_EXP;
+        } else {
+            jv_end_number(v, c);
+        }
+        break;
+    case JV_NUM_DOT:
+        v->state = jv_is_digit(c) ? JV_NUM_FRAC : JV_ERROR;
+        break;
+    case JV_NUM_FRAC:
+        if (jv_is_digit(c)) break;
+        if ('e' == c || 'E' == c) {
+            v->state = JV_NUM_EXP;
+        } else {
+            jv_end_number(v, c);
+        }
+        break;
+    case JV_NUM_EXP:
+        if ('+' == c || '-' == c) {
+            v->state = JV_NUM_EXP_SIGN;
+        } else {
+            v->state = jv_is_digit(c) ? JV_NUM_EXP_DIGITS : JV_ERROR;
+        }
+        break;
+    case JV_NUM_EXP_SIGN:
+        v->state = jv_is_digit(c) ? JV_NUM_EXP_DIGITS : JV_ERROR;
+        break;
+    case JV_NUM_EXP_DIGITS:
+        if (!jv_is_digit(c)) {
+            jv_end_number(v, c);
+        }
+        break;
+    default:
+        v->state = JV_ERROR;
+    }
+}
+
+// returns -1 on syntax error, further input is ignored after that
+static int json_validator_feed(json_validator_t* v, const unsigned char* data, size_t len) {
+    for (size_t i = 0; i < len && JV_ERROR != v->state; i++) {
+        jv_step(v, data[i]);
+    }
+    return JV_ERROR == v->state ? -1 : 0;
+}
+
+// to be called after the last chunk
+static int json_validator_complete(json_validator_t* v) {
+    // top-level number has no delimiter after it
+    if (0 == v->depth && (JV_NUM_ZERO == v->state || JV_NUM_INT == v->state ||
+            JV_NUM_FRAC == v->state || JV_NUM_EXP_DIGITS == v->state)) {
+        return 1;
+    }
+    return JV_DONE == v->state;
+}
+
+#endif /* JSON_HANDLER_JSON_VALIDATOR_H */
@@ -24,66 +24,458 @@
 
 #include <jansson.h>
 
+#include "../../include/json_handler.h"
 #include "dyload.h"
 #include "hex.h"
 #include "jansson_import.h"
+#include "json_validator.h"
+#include "json_extract.h"
+#include "envelope_writer.h"
+#include "ring_transport.h"
+#include "body_fd.h"
+#include "request_ctx.h"
+#include "coalesce.h"
+#include "subrequest_queue.h"
+#include "handler_library.h"
+#include "response_headers.h"
 
 #define FORMAT_JSON "json"
 #define FORMAT_STRING "string"
 #define FORMAT_HEX "stringHex"
 #define FORMAT_FILE "file"
+#define FORMAT_FD "fd"
+#define FORMAT_EXTRACTED "extracted"
+// binary envelopes only
+#define FORMAT_BYTES "bytes"
 
-typedef int (*submit_json_request_type)(const char*);
+#define RELOAD_LIBRARY_MAX_LEN 256
+
+#define RING_RECONNECT_MIN_DELAY 100
+#define RING_RECONNECT_MAX_DELAY 10000
 
 static ngx_str_t json_handle_library;
-static submit_json_request_type submit_json_request_fun = NULL;
+static handler_library_t* library_current = NULL;
 
-static ngx_int_t initialize(ngx_cycle_t* cycle) {
-    // load jansson
-    int err_jansson = jansson_initialize();
-    if (0 != err_jansson) {
-        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "cannot initialize 'jansson' library");
+// loaded in master, workers inherit the mapping
+static void* library_preloaded = NULL;
+static char* library_preloaded_name = NULL;
+
+static int envelope_format = ENVELOPE_JSON;
+
+// selected values from json bodies
+typedef struct extract_pointer_s {
+    char* name;
+    json_pointer_token_t* tokens;
+    size_t count;
+} extract_pointer_t;
+
+// per-location settings
+typedef struct json_handler_loc_conf_s {
+    ngx_http_complex_value_t* coalesce_key;
+    ngx_uint_t coalesce_max_waiters;
+    ngx_msec_t coalesce_timeout;
+    // requests in flight, separate in each worker after fork
+    ngx_rbtree_t coalesce_tree;
+    ngx_rbtree_node_t coalesce_sentinel;
+    // 'extract_pointer_t' elements
+    ngx_array_t* extract_pointers;
+    ngx_flag_t extract_drop_body;
+} json_handler_loc_conf_t;
+
+// shared 'data' objects for bodiless requests
+static json_t* empty_data = NULL;
+static json_t* empty_data_extracted = NULL;
+
+static ngx_http_request_body_filter_pt next_request_body_filter;
+
+// out-of-process handler
+static char* ring_socket_path = NULL;
+static size_t ring_size = 4 * 1024 * 1024;
+static ring_transport_t ring_transport;
+static ngx_connection_t* ring_connection = NULL;
+static ngx_connection_t* ring_socket_connection = NULL;
+static ngx_event_t ring_reconnect_event;
+// event ident for debug logging
+static ngx_connection_t ring_reconnect_dummy;
+static ngx_msec_t ring_reconnect_delay = RING_RECONNECT_MIN_DELAY;
+// submitted requests waiting for responses
+static ngx_rbtree_t ring_pending_tree;
+static ngx_rbtree_node_t ring_pending_sentinel;
+
+// hot reload, library name is shared between workers
+typedef struct reload_state_s {
+    ngx_atomic_t generation;
+    size_t library_len;
+    u_char library[RELOAD_LIBRARY_MAX_LEN];
+} reload_state_t;
+
+static ngx_shm_zone_t* reload_zone = NULL;
+static ngx_atomic_uint_t reload_generation = 0;
+
+// spilled request bodies passed as descriptors
+static ngx_flag_t body_fd_enabled = 0;
+
+// subrequests issued on behalf of the library
+static ngx_connection_t* subrequest_connection = NULL;
+
+typedef struct subrequest_ctx_s {
+    ngx_http_post_subrequest_t ps;
+    handler_library_t* library;
+    long long handle;
+    long long tag;
+    ngx_flag_t delivered;
+} subrequest_ctx_t;
+
+static void set_empty_data(json_t* obj) {
+    json_object_set_new(obj, "format", json_string(FORMAT_STRING));
+    json_object_set_new(obj, FORMAT_JSON, json_null());
+    json_object_set_new(obj, FORMAT_STRING, json_string(""));
+    json_object_set_new(obj, FORMAT_HEX, json_null());
+    json_object_set_new(obj, FORMAT_FILE, json_null());
+    json_object_set_new(obj, FORMAT_FD, json_null());
+}
+
+// returns result to finalize the request with
+static ngx_int_t send_response(ngx_http_request_t* r, json_handler_response* resp) {
+    if (r->connection->error) {
         return NGX_ERROR;
     }
 
-    // load handler shared lib
-    if (0 == json_handle_library.len) {
-        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "handler shared library not specified");
-        return NGX_ERROR;
+    // 'Status' header overrides the status
+    r->headers_out.status = 0 != resp->status ? (ngx_uint_t) resp->status : NGX_HTTP_OK;
+
+    // headers
+    for (size_t i = 0; i < resp->headers_count; i++) {
+        const json_handler_header* hin = &resp->headers[i];
+        ngx_int_t err_header = response_header_set(r, (const u_char*) hin->key, NULL, hin->key_len,
+                (const u_char*) hin->value, hin->value_len);
+        if (NGX_OK != err_header) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
     }
 
-    // need nul-terminated string here,
-    // lets be consistent with string handling elsewhere
-    json_t* libname_json = json_stringn((const char*) json_handle_library.data, json_handle_library.len);
-    if (NULL == libname_json){
-        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "invalid shared library name specified");
-        return NGX_ERROR;
+    // body
+    ngx_buf_t* buf = ngx_calloc_buf(r->pool);
+    if (NULL == buf) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
+    if (resp->body_len > 0) {
+        buf->start = ngx_pnalloc(r->pool, resp->body_len);
+        if (NULL == buf->start) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                    "Pool allocation error, size: [%uz]", resp->body_len);
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+        memcpy(buf->start, resp->body, resp->body_len);
+        buf->pos = buf->start;
+        buf->last = buf->start + resp->body_len;
+        buf->end = buf->last;
+        buf->memory = 1;
+    }
+    buf->last_buf = 1;
 
-    // load lib
-    const char* libname = json_string_value(libname_json);
-    void* lib = dyload_library(libname);
-    if (NULL == lib) {
-        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "cannot load shared library, name: [%s]", libname);
-        json_decref(libname_json);
-        return NGX_ERROR;
+    // send
+    r->headers_out.content_length_n = resp->body_len;
+    ngx_int_t rc = ngx_http_send_header(r);
+    if (NGX_ERROR == rc || rc > NGX_OK || r->header_only) {
+        return rc;
     }
+    ngx_chain_t out;
+    out.buf = buf;
+    out.next = NULL;
+    return ngx_http_output_filter(r, &out);
+}
 
-    // lookup symbol
-    submit_json_request_fun = dyload_symbol(lib, "submit_json_request");
-    if (NULL == submit_json_request_fun) {
+// coalesced requests get the same response
+static void send_response_to_waiters(ngx_queue_t* waiters, json_handler_response* resp) {
+    while (!ngx_queue_empty(waiters)) {
+        ngx_queue_t* q = ngx_queue_head(waiters);
+        ngx_queue_remove(q);
+        json_handler_ctx_t* w = ngx_queue_data(q, json_handler_ctx_t, coalesce_queue);
+        w->coalesce_waiting = 0;
+        ngx_connection_t* c = w->request->connection;
+        ngx_http_finalize_request(w->request, send_response(w->request, resp));
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+static void ring_pending_cleanup(void* data) {
+    json_handler_ctx_t* ctx = data;
+    if (ctx->ring_pending) {
+        ngx_rbtree_delete(&ring_pending_tree, &ctx->ring_node);
+        ctx->ring_pending = 0;
+    }
+}
+
+// returns NULL if request with specified handle is not pending
+static json_handler_ctx_t* ring_pending_take(uint64_t handle) {
+    ngx_rbtree_key_t key = (ngx_rbtree_key_t) handle;
+    if ((uint64_t) key != handle) {
+        return NULL;
+    }
+    ngx_rbtree_node_t* node = ring_pending_tree.root;
+    ngx_rbtree_node_t* sentinel = ring_pending_tree.sentinel;
+    while (node != sentinel) {
+        if (key == node->key) {
+            json_handler_ctx_t* ctx = (json_handler_ctx_t*)
+                    ((u_char*) node - offsetof(json_handler_ctx_t, ring_node));
+            ring_pending_cleanup(ctx);
+            return ctx;
+        }
+        node = key < node->key ? node->left : node->right;
+    }
+    return NULL;
+}
+
+static void ring_deliver_response(const char* msg, size_t len, ngx_log_t* log) {
+    ring_response_t rresp;
+    if (0 != ring_response_parse(msg, len, &rresp)) {
+        ngx_log_error(NGX_LOG_ERR, log, 0, "Invalid ring response received, size: [%uz]", len);
+        return;
+    }
+    // handle comes from another process
+    json_handler_ctx_t* ctx = ring_pending_take(rresp.handle);
+    if (NULL == ctx) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                "Ring response for unknown request dropped, handle: [%uL]", rresp.handle);
+        return;
+    }
+    ngx_http_request_t* r = ctx->request;
+
+    json_handler_header* headers = NULL;
+    if (rresp.headers_count > 0) {
+        headers = malloc(rresp.headers_count * sizeof(json_handler_header));
+        if (NULL == headers) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                    "Headers allocation error, count: [%uD]", rresp.headers_count);
+            ngx_connection_t* c = r->connection;
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            ngx_http_run_posted_requests(c);
+            return;
+        }
+    }
+    jh_ring_reader reader = rresp.headers;
+    for (uint32_t i = 0; i < rresp.headers_count; i++) {
+        const char* data;
+        uint32_t data_len;
+        // validated in ring_response_parse
+        jh_ring_read_bytes(&reader, &data, &data_len);
+        headers[i].key = data;
+        headers[i].key_len = data_len;
+        jh_ring_read_bytes(&reader, &data, &data_len);
+        headers[i].value = data;
+        headers[i].value_len = data_len;
+    }
+
+    json_handler_response resp;
+    memset(&resp, '\0', sizeof(resp));
+    resp.status = (int) rresp.status;
+    resp.headers = headers;
+    resp.headers_count = rresp.headers_count;
+    resp.body = rresp.body;
+    resp.body_len = rresp.body_len;
+
+    ngx_queue_t waiters;
+    coalesce_detach(ctx, &waiters);
+
+    ngx_connection_t* c = r->connection;
+    ngx_http_finalize_request(r, send_response(r, &resp));
+    ngx_http_run_posted_requests(c);
+
+    send_response_to_waiters(&waiters, &resp);
+
+    free(headers);
+}
+
+static void ring_close() {
+    if (NULL != ring_connection) {
+        // closes response doorbell
+        ngx_close_connection(ring_connection);
+        ring_connection = NULL;
+        ring_transport.response_efd = -1;
+    }
+    if (NULL != ring_socket_connection) {
+        ngx_close_connection(ring_socket_connection);
+        ring_socket_connection = NULL;
+        ring_transport.sock = -1;
+    }
+    ring_transport_close(&ring_transport);
+}
+
+// waiters of coalesced requests are failed together with their leaders
+static void ring_fail_pending() {
+    while (ring_pending_tree.root != ring_pending_tree.sentinel) {
+        ngx_rbtree_node_t* node = ngx_rbtree_min(ring_pending_tree.root, ring_pending_tree.sentinel);
+        json_handler_ctx_t* ctx = (json_handler_ctx_t*)
+                ((u_char*) node - offsetof(json_handler_ctx_t, ring_node));
+        ring_pending_cleanup(ctx);
+
+        ngx_queue_t waiters;
+        coalesce_detach(ctx, &waiters);
+
+        ngx_connection_t* c = ctx->request->connection;
+        ngx_http_finalize_request(ctx->request, NGX_HTTP_BAD_GATEWAY);
+        ngx_http_run_posted_requests(c);
+
+        while (!ngx_queue_empty(&waiters)) {
+            ngx_queue_t* q = ngx_queue_head(&waiters);
+            ngx_queue_remove(q);
+            json_handler_ctx_t* w = ngx_queue_data(q, json_handler_ctx_t, coalesce_queue);
+            w->coalesce_waiting = 0;
+            ngx_connection_t* wc = w->request->connection;
+            ngx_http_finalize_request(w->request, NGX_HTTP_BAD_GATEWAY);
+            ngx_http_run_posted_requests(wc);
+        }
+    }
+}
+
+static void ring_schedule_reconnect(ngx_log_t* log) {
+    if (ngx_exiting || ring_reconnect_event.timer_set) {
+        return;
+    }
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+            "Ring transport is not connected, retrying in: [%M] ms, socket: [%s]",
+            ring_reconnect_delay, ring_socket_path);
+    ngx_add_timer(&ring_reconnect_event, ring_reconnect_delay);
+    ring_reconnect_delay = ngx_min(ring_reconnect_delay * 2, RING_RECONNECT_MAX_DELAY);
+}
+
+// handler process is gone or the ring is corrupted
+static void ring_disconnect(ngx_log_t* log) {
+    ring_close();
+    ring_fail_pending();
+    ring_schedule_reconnect(log);
+}
+
+// returns NGX_ERROR if the ring must be closed
+static ngx_int_t ring_drain(ngx_log_t* log) {
+    for (;;) {
+        size_t len = 0;
+        char* msg = NULL;
+        ngx_int_t rc = ring_transport_receive(&ring_transport, &msg, &len, log);
+        if (NGX_AGAIN == rc) {
+            return NGX_OK;
+        }
+        if (NGX_OK != rc) {
+            return NGX_ERROR;
+        }
+        ring_deliver_response(msg, len, log);
+        free(msg);
+    }
+}
+
+static void ring_doorbell_handler(ngx_event_t* ev) {
+    // cleared before draining, doorbell rung during draining
+    // triggers the handler again
+    ring_transport_clear_doorbell(&ring_transport);
+
+    if (NGX_OK != ring_drain(ev->log)) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+                "Closing ring transport, socket: [%s]", ring_socket_path);
+        ring_disconnect(ev->log);
+        return;
+    }
+
+    if (NGX_OK != ngx_handle_read_event(ev, 0)) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0, "Cannot re-arm ring doorbell event");
+    }
+}
+
+// handler process never writes to the socket,
+// end of stream means it is gone
+static void ring_socket_handler(ngx_event_t* ev) {
+    ngx_connection_t* c = ev->data;
+    u_char buf[64];
+    ssize_t n;
+    while ((n = recv(c->fd, buf, sizeof(buf), 0)) > 0) {
+        // no-op
+    }
+    if (-1 == n && NGX_EAGAIN == ngx_socket_errno) {
+        if (NGX_OK != ngx_handle_read_event(ev, 0)) {
+            ngx_log_error(NGX_LOG_ERR, ev->log, 0, "Cannot re-arm ring socket event");
+        }
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+            "Handler process disconnected, socket: [%s]", ring_socket_path);
+    // responses written before exit are still delivered
+    ring_drain(ev->log);
+    ring_disconnect(ev->log);
+}
+
+static ngx_connection_t* ring_add_connection(ngx_socket_t fd, ngx_event_handler_pt handler, ngx_log_t* log) {
+    ngx_connection_t* c = ngx_get_connection(fd, log);
+    if (NULL == c) {
+        return NULL;
+    }
+    c->log = log;
+    c->read->log = log;
+    c->read->handler = handler;
+    if (NGX_OK != ngx_handle_read_event(c->read, 0)) {
+        ngx_log_error(NGX_LOG_ERR, log, 0, "cannot register ring event");
+        ngx_free_connection(c);
+        return NULL;
+    }
+    return c;
+}
+
+static ngx_int_t initialize_ring(ngx_cycle_t* cycle) {
+    ngx_int_t err_open = ring_transport_open(&ring_transport, ring_socket_path, ring_size, cycle->log);
+    if (NGX_OK != err_open) {
         ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
-                "cannot find symbol 'submit_json_request' in shared library, name: [%s]", libname);
-        json_decref(libname_json);
+                "cannot open ring transport, socket: [%s]", ring_socket_path);
         return NGX_ERROR;
     }
-    json_decref(libname_json);
+
+    ring_connection = ring_add_connection(ring_transport.response_efd, ring_doorbell_handler, cycle->log);
+    if (NULL != ring_connection) {
+        ring_socket_connection = ring_add_connection(ring_transport.sock, ring_socket_handler, cycle->log);
+    }
+    if (NULL == ring_connection || NULL == ring_socket_connection) {
+        ring_close();
+        return NGX_ERROR;
+    }
+    ring_reconnect_delay = RING_RECONNECT_MIN_DELAY;
 
     return NGX_OK;
 }
 
-static json_t* read_headers(ngx_http_headers_in_t* headers_in) {
-    ngx_list_part_t* part = &headers_in->headers.part;
+static void ring_reconnect_handler(ngx_event_t* ev) {
+    if (ngx_exiting) {
+        return;
+    }
+    if (NGX_OK != initialize_ring((ngx_cycle_t*) ngx_cycle)) {
+        ring_schedule_reconnect(ev->log);
+        return;
+    }
+    ngx_log_error(NGX_LOG_NOTICE, ev->log, 0,
+            "Ring transport connected, socket: [%s]", ring_socket_path);
+}
+
+// tracks the request until its response is received,
+// returns -1 if the request cannot be submitted
+static int ring_submit(ngx_http_request_t* r, const char* data, size_t len) {
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    ngx_pool_cleanup_t* cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (NULL == cln) {
+        return -1;
+    }
+    cln->handler = ring_pending_cleanup;
+    cln->data = ctx;
+
+    int err_submit = ring_transport_submit(&ring_transport, data, len);
+    if (0 != err_submit) {
+        return err_submit;
+    }
+    ctx->ring_node.key = (ngx_rbtree_key_t) (uintptr_t) r;
+    ngx_rbtree_insert(&ring_pending_tree, &ctx->ring_node);
+    ctx->ring_pending = 1;
+    return 0;
+}
+
+static json_t* read_header_list(ngx_list_t* headers) {
+    ngx_list_part_t* part = &headers->part;
     ngx_table_elt_t* elts = part->elts;
 
     json_t* res = json_object();
@@ -98,6 +490,11 @@ static json_t* read_headers(ngx_http_headers_in_t* headers_in) {
             i = 0;
         }
 
+        // removed header
+        if (0 == elts[i].hash) {
+            continue;
+        }
+
         ngx_str_t key = elts[i].key;
         ngx_str_t value = elts[i].value;
 
@@ -115,6 +512,610 @@ static json_t* read_headers(ngx_http_headers_in_t* headers_in) {
     return res;
 }
 
+static ngx_int_t subrequest_deliver(ngx_http_request_t* sr, void* data, ngx_int_t rc) {
+    subrequest_ctx_t* sctx = data;
+    if (sctx->delivered) {
+        return rc;
+    }
+    sctx->delivered = 1;
+
+    // status
+    ngx_int_t status = (ngx_int_t) sr->headers_out.status;
+    if (NGX_ERROR == rc || 0 == status) {
+        status = rc >= NGX_HTTP_SPECIAL_RESPONSE ? rc : NGX_HTTP_BAD_GATEWAY;
+    }
+
+    // body, collected in memory
+    size_t len = 0;
+    for (ngx_chain_t* cl = sr->out; NULL != cl; cl = cl->next) {
+        if (ngx_buf_in_memory(cl->buf)) {
+            len += cl->buf->last - cl->buf->pos;
+        }
+    }
+    u_char* body = ngx_pnalloc(sr->pool, len > 0 ? len : 1);
+    if (NULL == body) {
+        ngx_log_error(NGX_LOG_ERR, sr->connection->log, 0,
+                "Pool allocation error, size: [%uz]", len);
+        return NGX_ERROR;
+    }
+    u_char* pos = body;
+    for (ngx_chain_t* cl = sr->out; NULL != cl; cl = cl->next) {
+        if (ngx_buf_in_memory(cl->buf)) {
+            pos = ngx_cpymem(pos, cl->buf->pos, cl->buf->last - cl->buf->pos);
+        }
+    }
+
+    json_t* headers = read_header_list(&sr->headers_out.headers);
+    if (sr->headers_out.content_type.len > 0) {
+        json_t* ct = json_stringn((const char*) sr->headers_out.content_type.data,
+                sr->headers_out.content_type.len);
+        if (NULL != ct) {
+            json_object_set_new(headers, "Content-Type", ct);
+        }
+    }
+
+    json_t* res = json_object();
+    json_object_set_new(res, "requestHandle", json_integer(sctx->handle));
+    json_object_set_new(res, "tag", json_integer(sctx->tag));
+    json_object_set_new(res, "status", json_integer(status));
+    json_object_set_new(res, "headers", headers);
+    json_t* utf8 = json_stringn((const char*) body, len);
+    if (NULL != utf8) {
+        json_object_set_new(res, "body", utf8);
+        json_object_set_new(res, "bodyHex", json_null());
+    } else { // got non-utf8 data
+        char* body_hex = hex_encode(body, len);
+        json_t* hex = json_stringn(body_hex, len * 2);
+        free(body_hex);
+        json_object_set_new(res, "body", json_null());
+        json_object_set_new(res, "bodyHex", NULL != hex ? hex : json_string(""));
+    }
+
+    char* dumped = json_dumps(res, JSON_INDENT(4));
+    json_decref(res);
+    if (NULL != dumped) {
+        sctx->library->receive_subrequest_response(dumped);
+        free(dumped);
+    }
+    return rc;
+}
+
+static void subrequest_fail(handler_library_t* library, long long handle, long long tag) {
+    json_t* res = json_object();
+    json_object_set_new(res, "requestHandle", json_integer(handle));
+    json_object_set_new(res, "tag", json_integer(tag));
+    json_object_set_new(res, "status", json_integer(NGX_HTTP_INTERNAL_SERVER_ERROR));
+    json_object_set_new(res, "headers", json_object());
+    json_object_set_new(res, "body", json_string(""));
+    json_object_set_new(res, "bodyHex", json_null());
+    char* dumped = json_dumps(res, JSON_INDENT(4));
+    json_decref(res);
+    if (NULL != dumped) {
+        library->receive_subrequest_response(dumped);
+        free(dumped);
+    }
+}
+
+static ngx_int_t subrequest_issue(ngx_http_request_t* r, handler_library_t* library,
+        subrequest_item_t* item) {
+    subrequest_ctx_t* sctx = ngx_pcalloc(r->pool, sizeof(subrequest_ctx_t));
+    ngx_str_t* uri = ngx_palloc(r->pool, sizeof(ngx_str_t));
+    ngx_str_t* args = ngx_palloc(r->pool, sizeof(ngx_str_t));
+    if (NULL == sctx || NULL == uri || NULL == args) {
+        return NGX_ERROR;
+    }
+    uri->len = strlen(item->uri);
+    uri->data = ngx_pnalloc(r->pool, uri->len + 1);
+    args->len = strlen(item->args);
+    args->data = ngx_pnalloc(r->pool, args->len + 1);
+    if (NULL == uri->data || NULL == args->data) {
+        return NGX_ERROR;
+    }
+    ngx_memcpy(uri->data, item->uri, uri->len + 1);
+    ngx_memcpy(args->data, item->args, args->len + 1);
+    sctx->library = library;
+    sctx->handle = item->handle;
+    sctx->tag = item->tag;
+    sctx->ps.handler = subrequest_deliver;
+    sctx->ps.data = sctx;
+
+    // parent request only waits for the response from library
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_request_t* sr = NULL;
+    return ngx_http_subrequest(r, uri, args, &sr, &sctx->ps,
+            NGX_HTTP_SUBREQUEST_IN_MEMORY | NGX_HTTP_SUBREQUEST_WAITED);
+}
+
+static void subrequest_wake_handler(ngx_event_t* ev) {
+    // cleared before taking items, wake up during processing
+    // triggers the handler again
+    subrequest_clear_wake();
+
+    subrequest_item_t* item = subrequest_take_all();
+    while (NULL != item) {
+        subrequest_item_t* next = item->next;
+        ngx_http_request_t* r = (ngx_http_request_t*) (uintptr_t) item->handle;
+        ngx_connection_t* c = r->connection;
+        // results go to the library version the request is submitted to
+        json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+        handler_library_t* library = NULL != ctx ? ctx->library : NULL;
+        if (NULL == library || NULL == library->receive_subrequest_response) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                    "Subrequest results cannot be delivered, uri: [%s]", item->uri);
+        } else if (NGX_OK != subrequest_issue(r, library, item)) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                    "Cannot create subrequest, uri: [%s]", item->uri);
+            subrequest_fail(library, item->handle, item->tag);
+        }
+        subrequest_item_free(item);
+        ngx_http_run_posted_requests(c);
+        item = next;
+    }
+
+    if (NGX_OK != ngx_handle_read_event(ev, 0)) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0, "Cannot re-arm subrequest wake up event");
+    }
+}
+
+static ngx_int_t initialize_subrequests(ngx_cycle_t* cycle) {
+    if (0 != pipe(subrequest_pipe)) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, ngx_errno, "cannot create subrequest pipe");
+        return NGX_ERROR;
+    }
+    if (-1 == ngx_nonblocking(subrequest_pipe[0]) || -1 == ngx_nonblocking(subrequest_pipe[1])) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, ngx_errno, "cannot set subrequest pipe non-blocking");
+        subrequest_pipe_close();
+        return NGX_ERROR;
+    }
+
+    ngx_connection_t* c = ngx_get_connection(subrequest_pipe[0], cycle->log);
+    if (NULL == c) {
+        subrequest_pipe_close();
+        return NGX_ERROR;
+    }
+    c->log = cycle->log;
+    c->read->log = cycle->log;
+    c->read->handler = subrequest_wake_handler;
+    if (NGX_OK != ngx_handle_read_event(c->read, 0)) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "cannot register subrequest wake up event");
+        ngx_free_connection(c);
+        subrequest_pipe_close();
+        return NGX_ERROR;
+    }
+    subrequest_connection = c;
+
+    return NGX_OK;
+}
+
+// returns NGX_DECLINED if the same library is already loaded
+static ngx_int_t load_handler_library(ngx_cycle_t* cycle, ngx_str_t name, handler_library_t** loaded) {
+    if (0 == name.len) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "handler shared library not specified");
+        return NGX_ERROR;
+    }
+
+    // need nul-terminated string here,
+    // lets be consistent with string handling elsewhere
+    json_t* libname_json = json_stringn((const char*) name.data, name.len);
+    if (NULL == libname_json){
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "invalid shared library name specified");
+        return NGX_ERROR;
+    }
+
+    handler_library_t* hl = ngx_calloc(sizeof(handler_library_t), cycle->log);
+    if (NULL == hl) {
+        json_decref(libname_json);
+        return NGX_ERROR;
+    }
+
+    // load lib
+    const char* libname = json_string_value(libname_json);
+    void* lib = dyload_library(libname);
+    if (NULL == lib) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "cannot load shared library, name: [%s]", libname);
+        json_decref(libname_json);
+        ngx_free(hl);
+        return NGX_ERROR;
+    }
+    hl->lib = lib;
+
+    // must not be initialized twice
+    if (NULL != handler_library_find(lib)) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                "shared library is already loaded, name: [%s]", libname);
+        json_decref(libname_json);
+        dyload_close(lib);
+        ngx_free(hl);
+        return NGX_DECLINED;
+    }
+
+    // lookup symbol
+    if (ENVELOPE_JSON == envelope_format) {
+        // optional
+        hl->handle_json_request_sync = dyload_symbol(lib, "handle_json_request_sync");
+        hl->submit_json_request = dyload_symbol(lib, "submit_json_request");
+        if (NULL == hl->submit_json_request) {
+            ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                    "cannot find symbol 'submit_json_request' in shared library, name: [%s]", libname);
+            json_decref(libname_json);
+            dyload_close(lib);
+            ngx_free(hl);
+            return NGX_ERROR;
+        }
+    } else {
+        hl->submit_binary_request = dyload_symbol(lib, "submit_binary_request");
+        if (NULL == hl->submit_binary_request) {
+            ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                    "cannot find symbol 'submit_binary_request' in shared library, name: [%s]", libname);
+            json_decref(libname_json);
+            dyload_close(lib);
+            ngx_free(hl);
+            return NGX_ERROR;
+        }
+    }
+
+    // optional, required for subrequests
+    hl->receive_subrequest_response = dyload_symbol(lib, "receive_subrequest_response");
+    if (NULL != hl->receive_subrequest_response && NULL == subrequest_connection &&
+            NGX_OK != initialize_subrequests(cycle)) {
+        json_decref(libname_json);
+        dyload_close(lib);
+        ngx_free(hl);
+        return NGX_ERROR;
+    }
+
+    // optional, required for unloading after hot reload
+    hl->shutdown_json_handler = dyload_symbol(lib, "shutdown_json_handler");
+
+    // optional
+    init_json_handler_type init_fun = dyload_symbol(lib, "init_json_handler");
+    if (NULL != init_fun) {
+        static const json_handler_api api = {
+            subrequest_enqueue
+        };
+        int err_init = init_fun(&api);
+        if (0 != err_init) {
+            ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                    "'init_json_handler' call returned error, code: [%d], name: [%s]", err_init, libname);
+            json_decref(libname_json);
+            dyload_close(lib);
+            ngx_free(hl);
+            return NGX_ERROR;
+        }
+    }
+
+    // optional, called before the library gets any requests
+    warmup_json_handler_type warmup_fun = dyload_symbol(lib, "warmup_json_handler");
+    if (NULL != warmup_fun) {
+        int err_warmup = warmup_fun();
+        if (0 != err_warmup) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                    "'warmup_json_handler' call returned error, code: [%d], name: [%s]", err_warmup, libname);
+        }
+    }
+    json_decref(libname_json);
+
+    handler_library_register(hl);
+    *loaded = hl;
+    return NGX_OK;
+}
+
+// picks up library name published by the reload location in any worker,
+// in-flight requests stay with the old version; library is loaded,
+// initialized and warmed up inline, this worker does not process other
+// events until that is done; returns NGX_DECLINED if the library
+// is already loaded
+static ngx_int_t reload_check() {
+    if (NULL == reload_zone || NULL == library_current) {
+        return NGX_OK;
+    }
+    reload_state_t* state = reload_zone->data;
+    if (state->generation == reload_generation) {
+        return NGX_OK;
+    }
+
+    ngx_slab_pool_t* shpool = (ngx_slab_pool_t*) reload_zone->shm.addr;
+    u_char buf[RELOAD_LIBRARY_MAX_LEN];
+    ngx_shmtx_lock(&shpool->mutex);
+    ngx_atomic_uint_t generation = state->generation;
+    size_t len = state->library_len;
+    ngx_memcpy(buf, state->library, len);
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    // failed load is not retried on every request
+    reload_generation = generation;
+    if (0 == len) {
+        return NGX_OK;
+    }
+
+    ngx_str_t name;
+    name.data = buf;
+    name.len = len;
+    handler_library_t* hl = NULL;
+    ngx_int_t err_load = load_handler_library((ngx_cycle_t*) ngx_cycle, name, &hl);
+    if (NGX_OK != err_load) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                "Handler library reload failed, name: [%V]", &name);
+        return err_load;
+    }
+    handler_library_t* old = library_current;
+    library_current = hl;
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+            "Handler library reloaded, name: [%V], generation: [%uA]", &name, generation);
+    handler_library_retire(old, ngx_cycle->log);
+    return NGX_OK;
+}
+
+// closes library preloaded for the previous configuration
+static void preload_release(void* lib, char* libname, ngx_log_t* log) {
+    dyload_close(lib);
+    if (NULL == libname) {
+        return;
+    }
+    if (dyload_resident(libname)) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                "shared library cannot be unloaded, it stays mapped and updated file"
+                " is not picked up until nginx restart, name: [%s]", libname);
+    }
+    free(libname);
+}
+
+// runs in master process on every configuration load, workers find
+// both libraries already mapped and relocated; handler library
+// constructors run here, with master privileges; load error rejects
+// the new configuration, running workers are not affected
+static ngx_int_t preload(ngx_conf_t* cf) {
+    if (0 != jansson_initialize()) {
+        ngx_log_error(NGX_LOG_ERR, cf->log, 0, "cannot initialize 'jansson' library");
+        return NGX_ERROR;
+    }
+
+    void* prev = library_preloaded;
+    char* prev_name = library_preloaded_name;
+    if (NULL != ring_socket_path || 0 == json_handle_library.len) {
+        library_preloaded = NULL;
+        library_preloaded_name = NULL;
+        preload_release(prev, prev_name, cf->log);
+        return NGX_OK;
+    }
+    char* libname = ngx_pnalloc(cf->pool, json_handle_library.len + 1);
+    if (NULL == libname) {
+        return NGX_ERROR;
+    }
+    ngx_cpystrn((u_char*) libname, json_handle_library.data, json_handle_library.len + 1);
+
+    // previous version is kept until the new one is loaded
+    void* lib = dyload_library(libname);
+    if (NULL == lib) {
+        ngx_log_error(NGX_LOG_ERR, cf->log, 0, "cannot load shared library, name: [%s]", libname);
+        return NGX_ERROR;
+    }
+    if (lib == prev) {
+        // same file is already mapped, both references must be
+        // released for the updated file to be picked up
+        dyload_close(lib);
+        preload_release(prev, prev_name, cf->log);
+        library_preloaded = NULL;
+        library_preloaded_name = NULL;
+        lib = dyload_library(libname);
+        if (NULL == lib) {
+            ngx_log_error(NGX_LOG_ERR, cf->log, 0, "cannot load shared library, name: [%s]", libname);
+            return NGX_ERROR;
+        }
+    } else {
+        preload_release(prev, prev_name, cf->log);
+    }
+    library_preloaded = lib;
+    // checked on the next configuration load
+    library_preloaded_name = strdup(libname);
+
+    // synchronous handler takes JSON requests only
+    if (ENVELOPE_JSON != envelope_format &&
+            NULL != dyload_symbol(library_preloaded, "handle_json_request_sync")) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                "'handle_json_request_sync' is not used with binary request format, name: [%s]", libname);
+    }
+    return NGX_OK;
+}
+
+static ngx_int_t initialize(ngx_cycle_t* cycle) {
+    // no-op when already loaded by master
+    int err_jansson = jansson_initialize();
+    if (0 != err_jansson) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "cannot initialize 'jansson' library");
+        return NGX_ERROR;
+    }
+
+    // load handler shared lib, or connect to handler process
+    if (NULL != ring_socket_path) {
+        ngx_rbtree_init(&ring_pending_tree, &ring_pending_sentinel, ngx_rbtree_insert_value);
+        ring_reconnect_dummy.fd = (ngx_socket_t) -1;
+        ring_reconnect_event.data = &ring_reconnect_dummy;
+        ring_reconnect_event.handler = ring_reconnect_handler;
+        ring_reconnect_event.log = cycle->log;
+        // does not delay worker shutdown
+        ring_reconnect_event.cancelable = 1;
+        // handler process may be started after nginx
+        if (NGX_OK != initialize_ring(cycle)) {
+            ring_schedule_reconnect(cycle->log);
+        }
+    } else {
+        ngx_queue_init(&handler_libraries);
+        if (NGX_OK != load_handler_library(cycle, json_handle_library, &library_current)) {
+            return NGX_ERROR;
+        }
+    }
+
+    // bodiless requests, 'extracted' is present in locations with 'json_handler_extract'
+    empty_data = json_object();
+    empty_data_extracted = json_object();
+    if (NULL == empty_data || NULL == empty_data_extracted) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "cannot create empty data object");
+        return NGX_ERROR;
+    }
+    set_empty_data(empty_data);
+    set_empty_data(empty_data_extracted);
+    json_object_set_new(empty_data_extracted, FORMAT_EXTRACTED, json_null());
+
+    return NGX_OK;
+}
+
+static void finalize(ngx_cycle_t* cycle) {
+    if (NULL != ring_connection) {
+        ring_close();
+    }
+    if (NULL != subrequest_connection) {
+        // closes read end of the pipe
+        ngx_close_connection(subrequest_connection);
+        subrequest_connection = NULL;
+        subrequest_pipe[0] = -1;
+        subrequest_pipe_close();
+    }
+}
+
+static json_handler_ctx_t* create_ctx(ngx_http_request_t* r) {
+    json_handler_ctx_t* ctx = ngx_pcalloc(r->pool, sizeof(json_handler_ctx_t));
+    if (NULL == ctx) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "Pool allocation error, size: [%uz]", sizeof(json_handler_ctx_t));
+        return NULL;
+    }
+    ctx->request = r;
+    ngx_http_set_ctx(r, ctx, ngx_http_json_handler_module);
+    return ctx;
+}
+
+static void coalesce_waiter_timeout(ngx_event_t* ev) {
+    json_handler_ctx_t* ctx = ev->data;
+    ngx_http_request_t* r = ctx->request;
+    ngx_connection_t* c = r->connection;
+
+    // leader is gone without sending a response
+    ngx_int_t status = NGX_HTTP_BAD_GATEWAY;
+
+    if (NULL != ctx->coalesce_leader) {
+        json_handler_loc_conf_t* lcf = ngx_http_get_module_loc_conf(r, ngx_http_json_handler_module);
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                "Timed out waiting for coalesced request, timeout: [%M]", lcf->coalesce_timeout);
+        ngx_queue_remove(&ctx->coalesce_queue);
+        ctx->coalesce_leader->coalesce_waiters_count -= 1;
+        ctx->coalesce_leader = NULL;
+        status = NGX_HTTP_GATEWAY_TIME_OUT;
+    }
+    ctx->coalesce_waiting = 0;
+
+    ngx_http_finalize_request(r, status);
+    ngx_http_run_posted_requests(c);
+}
+
+static void coalesce_waiter_cleanup(void* data) {
+    json_handler_ctx_t* ctx = data;
+    if (NULL != ctx->coalesce_leader) {
+        ngx_queue_remove(&ctx->coalesce_queue);
+        ctx->coalesce_leader->coalesce_waiters_count -= 1;
+        ctx->coalesce_leader = NULL;
+    }
+    if (ctx->coalesce_timer.timer_set) {
+        ngx_del_timer(&ctx->coalesce_timer);
+    }
+    if (ctx->coalesce_timer.posted) {
+        ngx_delete_posted_event(&ctx->coalesce_timer);
+    }
+}
+
+static void coalesce_leader_cleanup(void* data) {
+    json_handler_ctx_t* ctx = data;
+    if (!ctx->coalesce_leading) {
+        return;
+    }
+
+    // leader finished without a response, release waiters
+    // from their own event handlers
+    ngx_queue_t waiters;
+    coalesce_detach(ctx, &waiters);
+    while (!ngx_queue_empty(&waiters)) {
+        ngx_queue_t* q = ngx_queue_head(&waiters);
+        ngx_queue_remove(q);
+        json_handler_ctx_t* w = ngx_queue_data(q, json_handler_ctx_t, coalesce_queue);
+        ngx_post_event(&w->coalesce_timer, &ngx_posted_events);
+    }
+}
+
+static int has_no_body(ngx_http_request_t* r) {
+    return r->headers_in.content_length_n <= 0 && !r->headers_in.chunked;
+}
+
+// returns NGX_DECLINED when request must be submitted by itself,
+// NGX_DONE when request is attached to the in-flight one with the same key
+static ngx_int_t coalesce_request(ngx_http_request_t* r, json_handler_ctx_t* ctx) {
+    // waiters never read their bodies, and requests with
+    // different bodies must not share a response
+    json_handler_loc_conf_t* lcf = ngx_http_get_module_loc_conf(r, ngx_http_json_handler_module);
+    if (NULL == lcf->coalesce_key || !has_no_body(r)) {
+        return NGX_DECLINED;
+    }
+
+    ngx_str_t key;
+    if (NGX_OK != ngx_http_complex_value(r, lcf->coalesce_key, &key)) {
+        return NGX_ERROR;
+    }
+    if (0 == key.len) {
+        return NGX_DECLINED;
+    }
+    uint32_t hash = ngx_crc32_long(key.data, key.len);
+
+    ngx_str_node_t* sn = ngx_str_rbtree_lookup(&lcf->coalesce_tree, &key, hash);
+
+    if (NULL == sn) { // become a leader
+        ngx_pool_cleanup_t* cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (NULL == cln) {
+            return NGX_ERROR;
+        }
+        cln->handler = coalesce_leader_cleanup;
+        cln->data = ctx;
+
+        ctx->coalesce_node.node.key = hash;
+        ctx->coalesce_node.str = key;
+        ctx->coalesce_tree = &lcf->coalesce_tree;
+        ngx_queue_init(&ctx->coalesce_waiters);
+        ngx_rbtree_insert(&lcf->coalesce_tree, &ctx->coalesce_node.node);
+        ctx->coalesce_leading = 1;
+        return NGX_DECLINED;
+    }
+
+    json_handler_ctx_t* leader = (json_handler_ctx_t*)
+            ((u_char*) sn - offsetof(json_handler_ctx_t, coalesce_node));
+    if (leader->coalesce_waiters_count >= lcf->coalesce_max_waiters) {
+        return NGX_DECLINED;
+    }
+
+    // become a waiter
+    ngx_pool_cleanup_t* cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (NULL == cln) {
+        return NGX_ERROR;
+    }
+    cln->handler = coalesce_waiter_cleanup;
+    cln->data = ctx;
+
+    ctx->coalesce_leader = leader;
+    ngx_queue_insert_tail(&leader->coalesce_waiters, &ctx->coalesce_queue);
+    leader->coalesce_waiters_count += 1;
+
+    ctx->coalesce_timer.handler = coalesce_waiter_timeout;
+    ctx->coalesce_timer.data = ctx;
+    ctx->coalesce_timer.log = r->connection->log;
+    ngx_add_timer(&ctx->coalesce_timer, lcf->coalesce_timeout);
+    ctx->coalesce_waiting = 1;
+
+    r->main->count++;
+    return NGX_DONE;
+}
+
+static json_t* read_headers(ngx_http_headers_in_t* headers_in) {
+    return read_header_list(&headers_in->headers);
+}
+
 static void json_set_ngx_string(json_t* obj, const char* key, ngx_str_t str) {
     json_t* jst = json_stringn((const char*) str.data, str.len);
     if (NULL != jst) {
@@ -139,22 +1140,116 @@ static json_t* read_meta(ngx_http_request_t* r) {
     return res;
 }
 
+// descriptors are meaningless for out-of-process handler
+static int pass_body_fd() {
+    return body_fd_enabled && NULL == ring_socket_path;
+}
+
+// returns NULL if body is not a json, or a key on extracted paths is not unique
+static json_t* extract_values(ngx_http_request_t* r, const u_char* data, size_t len) {
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    // body must be already checked by request_body_filter
+    if (NULL == ctx || !ctx->body_checked || !ctx->body_is_json) {
+        return NULL;
+    }
+
+    json_handler_loc_conf_t* lcf = ngx_http_get_module_loc_conf(r, ngx_http_json_handler_module);
+    json_t* res = json_object();
+    extract_pointer_t* eps = lcf->extract_pointers->elts;
+    for (size_t i = 0; i < lcf->extract_pointers->nelts; i++) {
+        const char* value = NULL;
+        size_t value_len = 0;
+        json_t* json = NULL;
+        int err = json_extract((const char*) data, len, eps[i].tokens, eps[i].count, &value, &value_len);
+        if (JSON_EXTRACT_DUPLICATE == err) {
+            // rejected by the parser too, checked here for 'drop_body'
+            json_decref(res);
+            return NULL;
+        }
+        if (0 == err) {
+            json = json_loadb(value, value_len, JSON_DECODE_ANY | JSON_REJECT_DUPLICATES, NULL);
+        }
+        json_object_set_new(res, eps[i].name, NULL != json ? json : json_null());
+    }
+    return res;
+}
+
+// spilled body is mapped instead of being read
+static json_t* extract_values_file(ngx_http_request_t* r) {
+#if (NGX_WIN32)
+    return NULL;
+#else
+    ngx_file_t* file = &r->request_body->temp_file->file;
+    size_t len = (size_t) file->offset;
+    if (0 == len) {
+        return NULL;
+    }
+    void* addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, file->fd, 0);
+    if (MAP_FAILED == addr) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                "Cannot map request body file, size: [%uz]", len);
+        return NULL;
+    }
+    // values are copied
+    json_t* res = extract_values(r, addr, len);
+    munmap(addr, len);
+    return res;
+#endif // NGX_WIN32
+}
+
+static json_t* extract_body_values(ngx_http_request_t* r) {
+    json_handler_loc_conf_t* lcf = ngx_http_get_module_loc_conf(r, ngx_http_json_handler_module);
+    if (NULL == lcf->extract_pointers) {
+        return NULL;
+    }
+    if (NULL != r->request_body->temp_file) {
+        return extract_values_file(r);
+    }
+    ngx_chain_t* in = r->request_body->bufs;
+    if (NULL == in || NULL == in->buf) {
+        return NULL;
+    }
+    return extract_values(r, in->buf->pos, in->buf->last - in->buf->pos);
+}
+
 static json_t* read_data(ngx_http_request_t* r) {
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    json_handler_loc_conf_t* lcf = ngx_http_get_module_loc_conf(r, ngx_http_json_handler_module);
     json_t* res = json_object();
+    json_t* extracted = extract_body_values(r);
+    int drop_body = NULL != extracted && lcf->extract_drop_body;
 
-    if (NULL == r->request_body->temp_file) {
+    if (drop_body) { // only extracted values are passed
+        json_object_set_new(res, "format", json_string(FORMAT_EXTRACTED));
+        json_object_set_new(res, FORMAT_JSON, json_null());
+        json_object_set_new(res, FORMAT_STRING, json_null());
+        json_object_set_new(res, FORMAT_HEX, json_null());
+        json_object_set_new(res, FORMAT_FILE, json_null());
+        json_object_set_new(res, FORMAT_FD, json_null());
+    } else if (NULL == r->request_body->temp_file) {
         ngx_chain_t* in = r->request_body->bufs;
         if (NULL != in && NULL != in->buf) {
             ngx_buf_t* buf = in->buf;
             size_t buf_len = buf->last - buf->pos;
-            json_t* json = json_loadb((const char*) buf->pos, buf_len, JSON_REJECT_DUPLICATES, NULL);
+            // skip parsing when body is already known to be not a json
+            json_t* json = NULL;
+            if (NULL == ctx || !ctx->body_checked || ctx->body_is_json) {
+                json = json_loadb((const char*) buf->pos, buf_len, JSON_REJECT_DUPLICATES, NULL);
+            }
             if (NULL != json) { // got valid json
                 json_object_set_new(res, "format", json_string(FORMAT_JSON));
                 json_object_set_new(res, FORMAT_JSON, json);
                 json_object_set_new(res, FORMAT_STRING, json_null());
                 json_object_set_new(res, FORMAT_HEX, json_null());
                 json_object_set_new(res, FORMAT_FILE, json_null());
+                json_object_set_new(res, FORMAT_FD, json_null());
             } else {
+                // duplicate keys pass validation but not parsing,
+                // such body is not a json for extraction too
+                if (NULL != extracted) {
+                    json_decref(extracted);
+                    extracted = NULL;
+                }
                 json_t* utf8 = json_stringn((const char*) buf->pos, buf_len);
                 if (NULL != utf8) { // got valid utf8 string
                     json_object_set_new(res, "format", json_string(FORMAT_STRING));
@@ -162,6 +1257,7 @@ static json_t* read_data(ngx_http_request_t* r) {
                     json_object_set_new(res, FORMAT_STRING, utf8);
                     json_object_set_new(res, FORMAT_HEX, json_null());
                     json_object_set_new(res, FORMAT_FILE, json_null());
+                    json_object_set_new(res, FORMAT_FD, json_null());
                 } else { // got non-utf8 data
                     char* data_hex = hex_encode(buf->pos, buf_len);
                     json_t* hex = json_stringn(data_hex, buf_len * 2);
@@ -175,15 +1271,20 @@ static json_t* read_data(ngx_http_request_t* r) {
                         json_object_set_new(res, FORMAT_HEX, json_string(""));
                     }
                     json_object_set_new(res, FORMAT_FILE, json_null());
+                    json_object_set_new(res, FORMAT_FD, json_null());
                 }
             }
         } else { // empty input
-            json_object_set_new(res, "format", json_string(FORMAT_STRING));
-            json_object_set_new(res, FORMAT_JSON, json_null());
-            json_object_set_new(res, FORMAT_STRING, json_string(""));
-            json_object_set_new(res, FORMAT_HEX, json_null());
-            json_object_set_new(res, FORMAT_FILE, json_null());
+            set_empty_data(res);
         }
+    } else if (pass_body_fd()) { // got a file, already unlinked
+        ngx_fd_t fd = body_fd_acquire(r);
+        json_object_set_new(res, "format", json_string(FORMAT_FD));
+        json_object_set_new(res, FORMAT_JSON, json_null());
+        json_object_set_new(res, FORMAT_STRING, json_null());
+        json_object_set_new(res, FORMAT_HEX, json_null());
+        json_object_set_new(res, FORMAT_FILE, json_null());
+        json_object_set_new(res, FORMAT_FD, json_integer(fd));
     } else { // got a file
         ngx_str_t path = r->request_body->temp_file->file.name;
         json_t* path_json = json_stringn((const char*) path.data, path.len);
@@ -196,21 +1297,177 @@ static json_t* read_data(ngx_http_request_t* r) {
         } else {
             json_object_set_new(res, FORMAT_FILE, json_string(""));
         }
+        json_object_set_new(res, FORMAT_FD, json_null());
+    }
+
+    if (NULL != lcf->extract_pointers) {
+        json_object_set_new(res, FORMAT_EXTRACTED, NULL != extracted ? extracted : json_null());
+    }
+
+    return res;
+}
+
+static void encode_data(envelope_t* env, ngx_http_request_t* r) {
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    json_handler_loc_conf_t* lcf = ngx_http_get_module_loc_conf(r, ngx_http_json_handler_module);
+    const char* format = FORMAT_STRING;
+    json_t* json = NULL;
+    const unsigned char* data = (const unsigned char*) "";
+    size_t data_len = 0;
+    ngx_str_t path = ngx_null_string;
+    ngx_fd_t fd = NGX_INVALID_FILE;
+    json_t* extracted = NULL;
+
+    if (NULL != r->request_body) {
+        extracted = extract_body_values(r);
+    }
+    int drop_body = NULL != extracted && lcf->extract_drop_body;
+
+    if (NULL == r->request_body) { // bodiless request
+        // no-op
+    } else if (drop_body) { // only extracted values are passed
+        format = FORMAT_EXTRACTED;
+    } else if (NULL == r->request_body->temp_file) {
+        ngx_chain_t* in = r->request_body->bufs;
+        if (NULL != in && NULL != in->buf) {
+            data = in->buf->pos;
+            data_len = in->buf->last - in->buf->pos;
+            if (NULL == ctx || !ctx->body_checked || ctx->body_is_json) {
+                json = json_loadb((const char*) data, data_len, JSON_REJECT_DUPLICATES, NULL);
+            }
+            if (NULL != json) {
+                format = FORMAT_JSON;
+            } else {
+                // duplicate keys pass validation but not parsing,
+                // such body is not a json for extraction too
+                if (NULL != extracted) {
+                    json_decref(extracted);
+                    extracted = NULL;
+                }
+                json_t* utf8 = json_stringn((const char*) data, data_len);
+                if (NULL != utf8) {
+                    json_decref(utf8);
+                } else { // non-utf8 data is passed as is
+                    format = FORMAT_BYTES;
+                }
+            }
+        }
+    } else if (pass_body_fd()) { // got a file, already unlinked
+        format = FORMAT_FD;
+        fd = body_fd_acquire(r);
+    } else { // got a file
+        format = FORMAT_FILE;
+        path = r->request_body->temp_file->file.name;
+    }
+
+    envelope_map(env, NULL != lcf->extract_pointers ? 7 : 6);
+    envelope_cstring(env, "format");
+    envelope_cstring(env, format);
+    envelope_cstring(env, FORMAT_JSON);
+    envelope_json(env, json);
+    envelope_cstring(env, FORMAT_STRING);
+    if (0 == strcmp(FORMAT_STRING, format)) {
+        envelope_string(env, (const char*) data, data_len);
+    } else {
+        envelope_null(env);
+    }
+    envelope_cstring(env, FORMAT_BYTES);
+    if (0 == strcmp(FORMAT_BYTES, format)) {
+        envelope_bytes(env, data, data_len);
+    } else {
+        envelope_null(env);
+    }
+    envelope_cstring(env, FORMAT_FILE);
+    if (0 == strcmp(FORMAT_FILE, format)) {
+        envelope_string(env, (const char*) path.data, path.len);
+    } else {
+        envelope_null(env);
+    }
+    envelope_cstring(env, FORMAT_FD);
+    if (0 == strcmp(FORMAT_FD, format)) {
+        envelope_int(env, fd);
+    } else {
+        envelope_null(env);
+    }
+    if (NULL != lcf->extract_pointers) {
+        envelope_cstring(env, FORMAT_EXTRACTED);
+        envelope_json(env, extracted);
+    }
+
+    if (NULL != json) {
+        json_decref(json);
+    }
+    if (NULL != extracted) {
+        json_decref(extracted);
+    }
+}
+
+static ngx_int_t submit_request_binary(ngx_http_request_t* r) {
+    json_t* meta = read_meta(r);
+    json_t* headers = read_headers(&r->headers_in);
+
+    envelope_t env;
+    envelope_init(&env, envelope_format);
+    envelope_map(&env, 3);
+    envelope_cstring(&env, "meta");
+    envelope_json(&env, meta);
+    envelope_cstring(&env, "headers");
+    envelope_json(&env, headers);
+    envelope_cstring(&env, "data");
+    encode_data(&env, r);
+    json_decref(meta);
+    json_decref(headers);
+
+    if (env.failed) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "Envelope allocation error, size: [%uz]", env.len);
+        envelope_free(&env);
+        return NGX_ERROR;
     }
 
-    return res;
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    int err_handle = NULL != ring_socket_path ?
+            ring_submit(r, (const char*) env.buf, env.len) :
+            ctx->library->submit_binary_request((const char*) env.buf, env.len);
+    envelope_free(&env);
+    if (0 != err_handle) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "'submit_binary_request' call returned error, code: [%d]", err_handle);
+        return NGX_ERROR;
+    }
+    return NGX_OK;
 }
 
-static void body_handler(ngx_http_request_t* r) {
+// returns NGX_DONE if the response is sent by synchronous handler
+static ngx_int_t handle_request_sync(ngx_http_request_t* r, const char* dumped, ngx_int_t* rc) {
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    json_handler_response resp;
+    memset(&resp, '\0', sizeof(resp));
+    int err_sync = ctx->library->handle_json_request_sync(dumped, &resp);
+    if (err_sync > 0) { // declined
+        return NGX_DECLINED;
+    }
+    if (err_sync < 0) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "'handle_json_request_sync' call returned error, code: [%d]", err_sync);
+        return NGX_ERROR;
+    }
 
-    if (NULL == r->request_body) {
-        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
-        return;
+    ngx_queue_t waiters;
+    coalesce_detach(ctx, &waiters);
+
+    *rc = send_response(r, &resp);
+    send_response_to_waiters(&waiters, &resp);
+
+    if (NULL != resp.release) {
+        resp.release(&resp);
     }
+    return NGX_DONE;
+}
 
+static ngx_int_t submit_request_json(ngx_http_request_t* r, json_t* data, ngx_int_t* rc) {
     json_t* meta = read_meta(r);
     json_t* headers = read_headers(&r->headers_in);
-    json_t* data = read_data(r);
     json_t* req = json_object();
     json_object_set_new(req, "meta", meta);
     json_object_set_new(req, "headers", headers);
@@ -218,21 +1475,174 @@ static void body_handler(ngx_http_request_t* r) {
 
     char* dumped = json_dumps(req, JSON_INDENT(4));
     json_decref(req);
-    int err_handle = submit_json_request_fun(dumped);
+
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    handler_library_t* library = ctx->library;
+    if (NULL != library && NULL != library->handle_json_request_sync) {
+        ngx_int_t err_sync = handle_request_sync(r, dumped, rc);
+        if (NGX_DECLINED != err_sync) {
+            free(dumped);
+            return err_sync;
+        }
+    }
+
+    int err_handle = NULL != ring_socket_path ?
+            ring_submit(r, dumped, strlen(dumped)) :
+            library->submit_json_request(dumped);
     free(dumped);
     if (0 != err_handle) {
         ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
                 "'submit_json_request' call returned error, code: [%d]", err_handle);
+        return NGX_ERROR;
+    }
+    return NGX_OK;
+}
+
+// request body is not read for bodiless requests,
+// returns NGX_DONE with the result to finalize request with in 'rc'
+// if the response is already sent
+static ngx_int_t submit_request(ngx_http_request_t* r, ngx_int_t* rc) {
+    // request stays with this library version after reload
+    if (NULL != library_current) {
+        json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+        if (NGX_OK != handler_library_acquire(library_current, r)) {
+            return NGX_ERROR;
+        }
+        ctx->library = library_current;
+    }
+
+    if (ENVELOPE_JSON != envelope_format) {
+        return submit_request_binary(r);
+    }
+    json_t* data = NULL;
+    if (NULL != r->request_body) {
+        data = read_data(r);
+    } else {
+        json_handler_loc_conf_t* lcf = ngx_http_get_module_loc_conf(r, ngx_http_json_handler_module);
+        data = json_incref(NULL != lcf->extract_pointers ? empty_data_extracted : empty_data);
+    }
+    return submit_request_json(r, data, rc);
+}
+
+static void body_handler(ngx_http_request_t* r) {
+
+    if (NULL == r->request_body) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    ngx_int_t rc = NGX_OK;
+    ngx_int_t err_submit = submit_request(r, &rc);
+    if (NGX_DONE == err_submit) {
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+    if (NGX_OK != err_submit) {
         ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
         return;
     }
 }
 
+static int is_json_content_type(ngx_http_request_t* r) {
+    ngx_table_elt_t* ct = r->headers_in.content_type;
+    if (NULL == ct) {
+        return 0;
+    }
+    // media type without parameters
+    size_t len = 0;
+    while (len < ct->value.len && ';' != ct->value.data[len] &&
+            ' ' != ct->value.data[len] && '\t' != ct->value.data[len]) {
+        len++;
+    }
+    size_t json_len = sizeof("application/json") - 1;
+    if (len == json_len && 0 == ngx_strncasecmp(ct->value.data, (u_char*) "application/json", len)) {
+        return 1;
+    }
+    // structured syntax suffix, e.g. 'application/problem+json'
+    size_t suffix_len = sizeof("+json") - 1;
+    return len > suffix_len &&
+            0 == ngx_strncasecmp(ct->value.data + len - suffix_len, (u_char*) "+json", suffix_len);
+}
+
+static ngx_int_t request_body_filter(ngx_http_request_t* r, ngx_chain_t* in) {
+    json_handler_ctx_t* ctx = ngx_http_get_module_ctx(r, ngx_http_json_handler_module);
+    if (NULL == ctx || NULL == ctx->validator || ctx->body_checked) {
+        return next_request_body_filter(r, in);
+    }
+
+    for (ngx_chain_t* cl = in; NULL != cl; cl = cl->next) {
+        ngx_buf_t* b = cl->buf;
+        size_t len = b->last - b->pos;
+        int err_feed = json_validator_feed(ctx->validator, b->pos, len);
+        if (0 != err_feed) {
+            ctx->body_checked = 1;
+            break;
+        }
+        if (b->last_buf) {
+            ctx->body_checked = 1;
+            ctx->body_is_json = json_validator_complete(ctx->validator);
+            break;
+        }
+    }
+
+    if (ctx->body_checked && !ctx->body_is_json && ctx->body_json_required) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                "Invalid JSON request body received");
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    return next_request_body_filter(r, in);
+}
+
 static ngx_int_t request_handler(ngx_http_request_t *r) {
 
+    // error is logged, old version keeps serving
+    reload_check();
+
+    // handler process is not connected, reconnect is pending
+    if (NULL != ring_socket_path && NULL == ring_connection) {
+        return NGX_HTTP_BAD_GATEWAY;
+    }
+
+    json_handler_ctx_t* ctx = create_ctx(r);
+    if (NULL == ctx) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_int_t err_coalesce = coalesce_request(r, ctx);
+    if (NGX_DONE == err_coalesce) {
+        return NGX_DONE;
+    }
+    if (NGX_DECLINED != err_coalesce) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    // GET, HEAD etc, no need to read anything
+    if (has_no_body(r)) {
+        ngx_int_t rc = NGX_OK;
+        ngx_int_t err_submit = submit_request(r, &rc);
+        if (NGX_DONE == err_submit) {
+            return rc;
+        }
+        if (NGX_OK != err_submit) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // keep request alive until response is received
+        r->main->count++;
+        return NGX_DONE;
+    }
+
+    // body is checked by request_body_filter as it arrives
+    ctx->validator = ngx_palloc(r->pool, sizeof(json_validator_t));
+    if (NULL == ctx->validator) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    json_validator_init(ctx->validator);
+    ctx->body_json_required = is_json_content_type(r);
+
     // http://mailman.nginx.org/pipermail/nginx/2007-August/001559.html
     r->request_body_in_single_buf = 1;
-    r->request_body_in_persistent_file = 1;
+    r->request_body_in_persistent_file = pass_body_fd() ? 0 : 1;
     r->request_body_in_clean_file = 1;
     r->request_body_file_log_level = 0;
 
@@ -245,6 +1655,146 @@ static ngx_int_t request_handler(ngx_http_request_t *r) {
     return NGX_DONE;
 }
 
+// only a file name is accepted, it is looked up in the directory
+// of the configured library
+static ngx_int_t reload_library_path(ngx_http_request_t* r, ngx_str_t* arg, ngx_str_t* path) {
+    u_char* name = ngx_pnalloc(r->pool, arg->len);
+    if (NULL == name) {
+        return NGX_ERROR;
+    }
+    u_char* src = arg->data;
+    u_char* dst = name;
+    ngx_unescape_uri(&dst, &src, arg->len, 0);
+    size_t name_len = dst - name;
+    if (0 == name_len) {
+        return NGX_DECLINED;
+    }
+    for (size_t i = 0; i < name_len; i++) {
+        if ('/' == name[i] || '\\' == name[i] || '\0' == name[i]) {
+            return NGX_DECLINED;
+        }
+    }
+
+    // including trailing separator
+    size_t dir_len = json_handle_library.len;
+    while (dir_len > 0 && '/' != json_handle_library.data[dir_len - 1] &&
+            '\\' != json_handle_library.data[dir_len - 1]) {
+        dir_len -= 1;
+    }
+    if (dir_len + name_len > RELOAD_LIBRARY_MAX_LEN) {
+        return NGX_DECLINED;
+    }
+
+    path->data = ngx_pnalloc(r->pool, dir_len + name_len);
+    if (NULL == path->data) {
+        return NGX_ERROR;
+    }
+    ngx_memcpy(ngx_cpymem(path->data, json_handle_library.data, dir_len), name, name_len);
+    path->len = dir_len + name_len;
+    return NGX_OK;
+}
+
+static ngx_int_t reload_handler(ngx_http_request_t* r) {
+    if (!(r->method & NGX_HTTP_POST)) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+    if (NULL == library_current) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "Hot reload is not supported with out-of-process handler");
+        return NGX_HTTP_CONFLICT;
+    }
+    ngx_int_t err_discard = ngx_http_discard_request_body(r);
+    if (NGX_OK != err_discard) {
+        return err_discard;
+    }
+
+    ngx_str_t arg;
+    if (NGX_OK != ngx_http_arg(r, (u_char*) "library", sizeof("library") - 1, &arg)) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                "No 'library' argument specified for reload");
+        return NGX_HTTP_BAD_REQUEST;
+    }
+    ngx_str_t name;
+    ngx_int_t err_path = reload_library_path(r, &arg, &name);
+    if (NGX_ERROR == err_path) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    if (NGX_OK != err_path) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                "Invalid 'library' argument specified for reload, file name expected: [%V]", &arg);
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    // publish for all workers
+    reload_state_t* state = reload_zone->data;
+    ngx_slab_pool_t* shpool = (ngx_slab_pool_t*) reload_zone->shm.addr;
+    ngx_shmtx_lock(&shpool->mutex);
+    ngx_memcpy(state->library, name.data, name.len);
+    state->library_len = name.len;
+    ngx_atomic_uint_t generation = ngx_atomic_fetch_add(&state->generation, 1) + 1;
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    // this worker reloads right away, others on their next request
+    ngx_int_t err_reload = reload_check();
+    if (NGX_DECLINED == err_reload) {
+        return NGX_HTTP_CONFLICT;
+    }
+    if (NGX_OK != err_reload) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    json_t* res = json_object();
+    json_object_set_new(res, "library", json_stringn((const char*) name.data, name.len));
+    json_object_set_new(res, "generation", json_integer((long long) generation));
+    char* dumped = json_dumps(res, JSON_INDENT(4));
+    json_decref(res);
+    if (NULL == dumped) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    json_handler_header ct;
+    ct.key = "Content-Type";
+    ct.key_len = sizeof("Content-Type") - 1;
+    ct.value = "application/json";
+    ct.value_len = sizeof("application/json") - 1;
+    json_handler_response resp;
+    memset(&resp, '\0', sizeof(resp));
+    resp.headers = &ct;
+    resp.headers_count = 1;
+    resp.body = dumped;
+    resp.body_len = strlen(dumped);
+    ngx_int_t rc = send_response(r, &resp);
+    free(dumped);
+    return rc;
+}
+
+static ngx_int_t reload_zone_init(ngx_shm_zone_t* zone, void* data) {
+    ngx_slab_pool_t* shpool = (ngx_slab_pool_t*) zone->shm.addr;
+
+    // nginx reload, configured library takes over again
+    if (NULL != data) {
+        reload_state_t* state = data;
+        ngx_shmtx_lock(&shpool->mutex);
+        state->library_len = 0;
+        ngx_shmtx_unlock(&shpool->mutex);
+        zone->data = data;
+        return NGX_OK;
+    }
+    if (zone->shm.exists) {
+        zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    reload_state_t* state = ngx_slab_alloc(shpool, sizeof(reload_state_t));
+    if (NULL == state) {
+        return NGX_ERROR;
+    }
+    ngx_memzero(state, sizeof(reload_state_t));
+    shpool->data = state;
+    zone->data = state;
+    return NGX_OK;
+}
+
 static char* conf_json_handler(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
     /* Install the handler. */
     ngx_http_core_loc_conf_t* clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
@@ -264,6 +1814,269 @@ static char* conf_json_handler_library(ngx_conf_t *cf, ngx_command_t *cmd, void
     return NGX_CONF_OK;
 }
 
+// splits pointer into unescaped reference tokens
+static ngx_int_t parse_pointer(ngx_conf_t* cf, ngx_str_t* ptr, extract_pointer_t* ep) {
+    ep->name = ngx_pnalloc(cf->pool, ptr->len + 1);
+    if (NULL == ep->name) {
+        return NGX_ERROR;
+    }
+    ngx_cpystrn((u_char*) ep->name, ptr->data, ptr->len + 1);
+
+    ep->count = 0;
+    for (size_t i = 0; i < ptr->len; i++) {
+        if ('/' == ptr->data[i]) {
+            ep->count += 1;
+        }
+    }
+    ep->tokens = ngx_palloc(cf->pool, ep->count * sizeof(json_pointer_token_t));
+    // unescaped tokens are never longer
+    u_char* buf = ngx_pnalloc(cf->pool, ptr->len);
+    if (NULL == ep->tokens || NULL == buf) {
+        return NGX_ERROR;
+    }
+
+    size_t idx = 0;
+    u_char* pos = buf;
+    for (size_t i = 1; i <= ptr->len; i++) {
+        if (i == ptr->len || '/' == ptr->data[i]) {
+            ep->tokens[idx].len = pos - buf;
+            ep->tokens[idx].data = (const char*) buf;
+            idx += 1;
+            buf = pos;
+        } else if ('~' == ptr->data[i]) {
+            if (i + 1 >= ptr->len || ('0' != ptr->data[i + 1] && '1' != ptr->data[i + 1])) {
+                return NGX_ERROR;
+            }
+            *pos++ = '0' == ptr->data[i + 1] ? '~' : '/';
+            i += 1;
+        } else {
+            *pos++ = ptr->data[i];
+        }
+    }
+    return NGX_OK;
+}
+
+static char* conf_json_handler_extract(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    json_handler_loc_conf_t* lcf = conf;
+    if (NULL != lcf->extract_pointers) {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                "conf_json_handler_extract: duplicate directive");
+        return NGX_CONF_ERROR;
+    }
+    ngx_str_t* elts = cf->args->elts;
+
+    ngx_array_t* pointers = ngx_array_create(cf->pool, cf->args->nelts, sizeof(extract_pointer_t));
+    if (NULL == pointers) {
+        return NGX_CONF_ERROR;
+    }
+    for (size_t i = 1; i < cf->args->nelts; i++) {
+        if (0 == ngx_strcmp(elts[i].data, "drop_body")) {
+            lcf->extract_drop_body = 1;
+            continue;
+        }
+        extract_pointer_t* ep = ngx_array_push(pointers);
+        if (NULL == ep) {
+            return NGX_CONF_ERROR;
+        }
+        if (0 == elts[i].len || '/' != elts[i].data[0] || NGX_OK != parse_pointer(cf, &elts[i], ep)) {
+            ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                    "conf_json_handler_extract: invalid JSON Pointer: [%V]", &elts[i]);
+            return NGX_CONF_ERROR;
+        }
+    }
+    if (0 == pointers->nelts) {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                "conf_json_handler_extract: at least one JSON Pointer must be specified");
+        return NGX_CONF_ERROR;
+    }
+    lcf->extract_pointers = pointers;
+
+    return NGX_CONF_OK;
+}
+
+static char* conf_json_handler_reload(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_str_t name = ngx_string("json_handler_reload");
+    ngx_shm_zone_t* zone = ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize,
+            &ngx_http_json_handler_module);
+    if (NULL == zone) {
+        return NGX_CONF_ERROR;
+    }
+    zone->init = reload_zone_init;
+    reload_zone = zone;
+
+    ngx_http_core_loc_conf_t* clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = reload_handler;
+    return NGX_CONF_OK;
+}
+
+static char* conf_json_handler_coalesce(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    json_handler_loc_conf_t* lcf = conf;
+    if (NULL != lcf->coalesce_key) {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                "conf_json_handler_coalesce: duplicate directive");
+        return NGX_CONF_ERROR;
+    }
+    if (cf->args->nelts < 2 || cf->args->nelts > 4) {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                "conf_json_handler_coalesce: invalid configuration parameters,"
+                " key and optional max waiters count and waiter timeout must be specified");
+        return NGX_CONF_ERROR;
+    }
+    ngx_str_t* elts = cf->args->elts;
+
+    // key
+    ngx_http_complex_value_t* cv = ngx_pcalloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (NULL == cv) {
+        return NGX_CONF_ERROR;
+    }
+    ngx_http_compile_complex_value_t ccv;
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+    ccv.cf = cf;
+    ccv.value = &elts[1];
+    ccv.complex_value = cv;
+    if (NGX_OK != ngx_http_compile_complex_value(&ccv)) {
+        return NGX_CONF_ERROR;
+    }
+    lcf->coalesce_key = cv;
+
+    // max waiters
+    if (cf->args->nelts > 2) {
+        ngx_int_t max = ngx_atoi(elts[2].data, elts[2].len);
+        if (NGX_ERROR == max || 0 == max) {
+            ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                    "conf_json_handler_coalesce: invalid max waiters count: [%V]", &elts[2]);
+            return NGX_CONF_ERROR;
+        }
+        lcf->coalesce_max_waiters = (ngx_uint_t) max;
+    }
+
+    // timeout
+    if (cf->args->nelts > 3) {
+        ngx_msec_t timeout = ngx_parse_time(&elts[3], 0);
+        if ((ngx_msec_t) NGX_ERROR == timeout) {
+            ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                    "conf_json_handler_coalesce: invalid waiter timeout: [%V]", &elts[3]);
+            return NGX_CONF_ERROR;
+        }
+        lcf->coalesce_timeout = timeout;
+    }
+
+    return NGX_CONF_OK;
+}
+
+static char* conf_json_handler_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_str_t* elts = cf->args->elts;
+    ngx_str_t format = elts[1];
+    if (format.len == sizeof("json") - 1 && 0 == ngx_strncmp(format.data, "json", format.len)) {
+        envelope_format = ENVELOPE_JSON;
+    } else if (format.len == sizeof("cbor") - 1 && 0 == ngx_strncmp(format.data, "cbor", format.len)) {
+        envelope_format = ENVELOPE_CBOR;
+    } else if (format.len == sizeof("msgpack") - 1 && 0 == ngx_strncmp(format.data, "msgpack", format.len)) {
+        envelope_format = ENVELOPE_MSGPACK;
+    } else {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                "conf_json_handler_format: invalid request format: [%V],"
+                " supported formats: 'json', 'cbor', 'msgpack'", &format);
+        return NGX_CONF_ERROR;
+    }
+    return NGX_CONF_OK;
+}
+
+static char* conf_json_handler_ring(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+#if !(NGX_LINUX)
+    ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+            "conf_json_handler_ring: ring transport is only supported on Linux");
+    return NGX_CONF_ERROR;
+#endif
+    ngx_str_t* elts = cf->args->elts;
+
+    // socket path
+    ngx_str_t path = elts[1];
+    ring_socket_path = ngx_pnalloc(cf->pool, path.len + 1);
+    if (NULL == ring_socket_path) {
+        return NGX_CONF_ERROR;
+    }
+    ngx_cpystrn((u_char*) ring_socket_path, path.data, path.len + 1);
+
+    // ring size
+    if (cf->args->nelts > 2) {
+        ssize_t size = ngx_parse_size(&elts[2]);
+        if (NGX_ERROR == size || size < 4096 || 0 != (size & (size - 1))) {
+            ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                    "conf_json_handler_ring: invalid ring size: [%V],"
+                    " power of two not less than 4k must be specified", &elts[2]);
+            return NGX_CONF_ERROR;
+        }
+        ring_size = (size_t) size;
+    }
+
+    return NGX_CONF_OK;
+}
+
+static char* conf_json_handler_body_fd(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_str_t* elts = cf->args->elts;
+
+    if (0 == ngx_strcasecmp(elts[1].data, (u_char*) "on")) {
+        body_fd_enabled = 1;
+    } else if (0 == ngx_strcasecmp(elts[1].data, (u_char*) "off")) {
+        body_fd_enabled = 0;
+    } else {
+        ngx_conf_log_error(NGX_LOG_ERR, cf, 0,
+                "conf_json_handler_body_fd: invalid value: [%V], 'on' or 'off' must be specified", &elts[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+static ngx_int_t preconfiguration(ngx_conf_t* cf) {
+    // zone of the previous cycle
+    reload_zone = NULL;
+    return NGX_OK;
+}
+
+static ngx_int_t postconfiguration(ngx_conf_t* cf) {
+    if (NGX_OK != preload(cf)) {
+        return NGX_ERROR;
+    }
+    if (NGX_OK != response_headers_init(cf)) {
+        return NGX_ERROR;
+    }
+    next_request_body_filter = ngx_http_top_request_body_filter;
+    ngx_http_top_request_body_filter = request_body_filter;
+    return NGX_OK;
+}
+
+static void* create_loc_conf(ngx_conf_t* cf) {
+    json_handler_loc_conf_t* lcf = ngx_pcalloc(cf->pool, sizeof(json_handler_loc_conf_t));
+    if (NULL == lcf) {
+        return NULL;
+    }
+    lcf->coalesce_max_waiters = NGX_CONF_UNSET_UINT;
+    lcf->coalesce_timeout = NGX_CONF_UNSET_MSEC;
+    ngx_rbtree_init(&lcf->coalesce_tree, &lcf->coalesce_sentinel, ngx_str_rbtree_insert_value);
+    return lcf;
+}
+
+static char* merge_loc_conf(ngx_conf_t* cf, void* parent, void* child) {
+    json_handler_loc_conf_t* prev = parent;
+    json_handler_loc_conf_t* lcf = child;
+    // max waiters and timeout are only set together with the key
+    if (NULL == lcf->coalesce_key) {
+        lcf->coalesce_key = prev->coalesce_key;
+        lcf->coalesce_max_waiters = prev->coalesce_max_waiters;
+        lcf->coalesce_timeout = prev->coalesce_timeout;
+    }
+    ngx_conf_merge_uint_value(lcf->coalesce_max_waiters, NGX_CONF_UNSET_UINT, 64);
+    ngx_conf_merge_msec_value(lcf->coalesce_timeout, NGX_CONF_UNSET_MSEC, 10000);
+    // 'drop_body' is an option of the same directive
+    if (NULL == lcf->extract_pointers) {
+        lcf->extract_pointers = prev->extract_pointers;
+        lcf->extract_drop_body = prev->extract_drop_body;
+    }
+    return NGX_CONF_OK;
+}
+
 static ngx_command_t conf_desc[] = {
 
     { ngx_string("json_handler"), /* directive */
@@ -280,12 +2093,54 @@ static ngx_command_t conf_desc[] = {
       0,
       NULL},
 
+    { ngx_string("json_handler_format"),
+      NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      conf_json_handler_format,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("json_handler_ring"),
+      NGX_HTTP_LOC_CONF | NGX_CONF_TAKE12,
+      conf_json_handler_ring,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("json_handler_body_fd"),
+      NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      conf_json_handler_body_fd,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("json_handler_extract"),
+      NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+      conf_json_handler_extract,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("json_handler_reload"),
+      NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+      conf_json_handler_reload,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("json_handler_coalesce"),
+      NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+      conf_json_handler_coalesce,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
     ngx_null_command /* command termination */
 };
 
 static ngx_http_module_t module_ctx = {
-    NULL, /* preconfiguration */
-    NULL, /* postconfiguration */
+    preconfiguration, /* preconfiguration */
+    postconfiguration, /* postconfiguration */
 
     NULL, /* create main configuration */
     NULL, /* init main configuration */
@@ -293,8 +2148,8 @@ static ngx_http_module_t module_ctx = {
     NULL, /* create server configuration */
     NULL, /* merge server configuration */
 
-    NULL, /* create location configuration */
-    NULL /* merge location configuration */
+    create_loc_conf, /* create location configuration */
+    merge_loc_conf /* merge location configuration */
 };
 
 ngx_module_t ngx_http_json_handler_module = {
@@ -307,7 +2162,7 @@ ngx_module_t ngx_http_json_handler_module = {
     initialize, /* init process */
     NULL, /* init thread */
     NULL, /* exit thread */
-    NULL, /* exit process */
+    finalize, /* exit process */
     NULL, /* exit master */
     NGX_MODULE_V1_PADDING
 };
\ No newline at end of file
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_REQUEST_CTX_H
+#define JSON_HANDLER_REQUEST_CTX_H
+
+// shared between handler and response modules,
+// response module looks up client request context by its handle
+extern ngx_module_t ngx_http_json_handler_module;
+
+typedef struct json_handler_ctx_s json_handler_ctx_t;
+
+struct json_handler_ctx_s {
+    ngx_http_request_t* request;
+
+    // coalescing, leader side
+    ngx_str_node_t coalesce_node;
+    ngx_rbtree_t* coalesce_tree;
+    ngx_queue_t coalesce_waiters;
+    ngx_uint_t coalesce_waiters_count;
+
+    // coalescing, waiter side
+    ngx_queue_t coalesce_queue;
+    json_handler_ctx_t* coalesce_leader;
+    ngx_event_t coalesce_timer;
+
+    // body validation, done while body is being received
+    struct json_validator_s* validator;
+
+    // library version the request is submitted to
+    struct handler_library_s* library;
+
+    // out-of-process handler, keyed by request handle
+    ngx_rbtree_node_t ring_node;
+
+    unsigned coalesce_leading:1;
+    unsigned coalesce_waiting:1;
+
+    unsigned ring_pending:1;
+
+    unsigned body_json_required:1;
+    unsigned body_checked:1;
+    unsigned body_is_json:1;
+};
+
+#endif /* JSON_HANDLER_REQUEST_CTX_H */
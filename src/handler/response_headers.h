@@ -0,0 +1,263 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_RESPONSE_HEADERS_H
+#define JSON_HANDLER_RESPONSE_HEADERS_H
+
+// 'nginx_version' for 'ngx_table_elt_t' layout
+#include <nginx.h>
+
+// shared between handler and response modules, well-known
+// headers are set into typed 'headers_out' fields, so filters
+// (gzip, not modified, range etc) can use them
+
+#define RESPONSE_HEADER_KNOWN_MAX_LEN 32
+
+typedef struct response_header_s response_header_t;
+
+// value is owned by the caller
+typedef ngx_int_t (*response_header_handler_pt)(ngx_http_request_t* r,
+        const response_header_t* rh, const u_char* value, size_t value_len);
+
+struct response_header_s {
+    ngx_str_t name;
+    response_header_handler_pt handler;
+    ngx_uint_t offset;
+};
+
+static ngx_hash_t response_headers_hash;
+
+static u_char* response_header_copy(ngx_http_request_t* r, const u_char* data, size_t len) {
+    u_char* res = ngx_pnalloc(r->pool, len > 0 ? len : 1);
+    if (NULL == res) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "Pool allocation error, size: [%uz]", len);
+        return NULL;
+    }
+    ngx_memcpy(res, data, len);
+    return res;
+}
+
+static ngx_table_elt_t* response_header_push(ngx_http_request_t* r, ngx_str_t* key,
+        const u_char* value, size_t value_len) {
+    ngx_table_elt_t* h = ngx_list_push(&r->headers_out.headers);
+    if (NULL == h) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "Header allocation error");
+        return NULL;
+    }
+    h->value.data = response_header_copy(r, value, value_len);
+    if (NULL == h->value.data) {
+        h->hash = 0;
+        return NULL;
+    }
+    h->value.len = value_len;
+    h->key = *key;
+    h->lowcase_key = NULL;
+    h->hash = 1;
+#if (nginx_version >= 1023000)
+    h->next = NULL;
+#endif
+    return h;
+}
+
+// name points to static table
+static ngx_int_t response_header_standard(ngx_http_request_t* r,
+        const response_header_t* rh, const u_char* value, size_t value_len) {
+    ngx_table_elt_t* h = response_header_push(r, (ngx_str_t*) &rh->name, value, value_len);
+    if (NULL == h) {
+        return NGX_ERROR;
+    }
+    if (0 != rh->offset) {
+        ngx_table_elt_t** field = (ngx_table_elt_t**) ((char*) &r->headers_out + rh->offset);
+        *field = h;
+    }
+    return NGX_OK;
+}
+
+// set by nginx itself
+static ngx_int_t response_header_ignore(ngx_http_request_t* r,
+        const response_header_t* rh, const u_char* value, size_t value_len) {
+    return NGX_OK;
+}
+
+static ngx_int_t response_header_status(ngx_http_request_t* r,
+        const response_header_t* rh, const u_char* value, size_t value_len) {
+    ngx_int_t status = ngx_atoi((u_char*) value, value_len);
+    if (3 != value_len || status < NGX_HTTP_OK || status > 599) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                "Invalid response status ignored, value: [%*s]", value_len, value);
+        return NGX_OK;
+    }
+    r->headers_out.status = (ngx_uint_t) status;
+    return NGX_OK;
+}
+
+// parsed the same way as 'ngx_http_upstream_copy_content_type()':
+// 'content_type_len' covers the media type before ';' and 'charset'
+// parameter is set separately, so charset filter can use it
+static ngx_int_t response_header_content_type(ngx_http_request_t* r,
+        const response_header_t* rh, const u_char* value, size_t value_len) {
+    u_char* data = response_header_copy(r, value, value_len);
+    if (NULL == data) {
+        return NGX_ERROR;
+    }
+    r->headers_out.content_type.data = data;
+    r->headers_out.content_type.len = value_len;
+    r->headers_out.content_type_len = value_len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    u_char* end = data + value_len;
+    for (u_char* p = data; p < end; p++) {
+        if (';' != *p) {
+            continue;
+        }
+        u_char* last = p;
+        while (++p < end && ' ' == *p) {
+            // skip spaces
+        }
+        if (p == end) {
+            return NGX_OK;
+        }
+        if ((size_t) (end - p) < sizeof("charset=") - 1 ||
+                0 != ngx_strncasecmp(p, (u_char*) "charset=", sizeof("charset=") - 1)) {
+            continue;
+        }
+        p += sizeof("charset=") - 1;
+        r->headers_out.content_type_len = last - data;
+        u_char* cs_end = end;
+        if (p < cs_end && '"' == *p) {
+            p++;
+        }
+        if (p < cs_end && '"' == *(cs_end - 1)) {
+            cs_end--;
+        }
+        r->headers_out.charset.data = p;
+        r->headers_out.charset.len = cs_end - p;
+        return NGX_OK;
+    }
+    return NGX_OK;
+}
+
+static ngx_int_t response_header_last_modified(ngx_http_request_t* r,
+        const response_header_t* rh, const u_char* value, size_t value_len) {
+    if (NGX_OK != response_header_standard(r, rh, value, value_len)) {
+        return NGX_ERROR;
+    }
+    r->headers_out.last_modified_time = ngx_parse_http_time((u_char*) value, value_len);
+    return NGX_OK;
+}
+
+// range filter adds the header itself
+static ngx_int_t response_header_accept_ranges(ngx_http_request_t* r,
+        const response_header_t* rh, const u_char* value, size_t value_len) {
+    if (value_len == sizeof("bytes") - 1 && 0 == ngx_strncasecmp((u_char*) value, (u_char*) "bytes", value_len)) {
+        r->allow_ranges = 1;
+        return NGX_OK;
+    }
+    return response_header_standard(r, rh, value, value_len);
+}
+
+static response_header_t response_headers[] = {
+    { ngx_string("Status"), response_header_status, 0 },
+    { ngx_string("Content-Type"), response_header_content_type, 0 },
+    { ngx_string("Content-Length"), response_header_ignore, 0 },
+    { ngx_string("Transfer-Encoding"), response_header_ignore, 0 },
+    { ngx_string("Connection"), response_header_ignore, 0 },
+    { ngx_string("Content-Encoding"), response_header_standard,
+            offsetof(ngx_http_headers_out_t, content_encoding) },
+    { ngx_string("Location"), response_header_standard,
+            offsetof(ngx_http_headers_out_t, location) },
+    { ngx_string("ETag"), response_header_standard,
+            offsetof(ngx_http_headers_out_t, etag) },
+    { ngx_string("Expires"), response_header_standard,
+            offsetof(ngx_http_headers_out_t, expires) },
+    { ngx_string("Last-Modified"), response_header_last_modified,
+            offsetof(ngx_http_headers_out_t, last_modified) },
+    { ngx_string("Accept-Ranges"), response_header_accept_ranges,
+            offsetof(ngx_http_headers_out_t, accept_ranges) },
+    { ngx_null_string, NULL, 0 }
+};
+
+static ngx_int_t response_headers_init(ngx_conf_t* cf) {
+    ngx_array_t keys;
+    if (NGX_OK != ngx_array_init(&keys, cf->temp_pool, 16, sizeof(ngx_hash_key_t))) {
+        return NGX_ERROR;
+    }
+    for (response_header_t* rh = response_headers; NULL != rh->handler; rh++) {
+        ngx_hash_key_t* hk = ngx_array_push(&keys);
+        if (NULL == hk) {
+            return NGX_ERROR;
+        }
+        hk->key = rh->name;
+        hk->key_hash = ngx_hash_key_lc(rh->name.data, rh->name.len);
+        hk->value = rh;
+    }
+
+    ngx_hash_init_t hinit;
+    hinit.hash = &response_headers_hash;
+    hinit.key = ngx_hash_key_lc;
+    hinit.max_size = 512;
+    hinit.bucket_size = ngx_align(64, ngx_cacheline_size);
+    hinit.name = "json_handler_response_headers_hash";
+    hinit.pool = cf->pool;
+    hinit.temp_pool = NULL;
+    return ngx_hash_init(&hinit, keys.elts, keys.nelts);
+}
+
+// 'lowcase_key' is optional
+static ngx_int_t response_header_set(ngx_http_request_t* r, const u_char* key, const u_char* lowcase_key,
+        size_t key_len, const u_char* value, size_t value_len) {
+    // well-known header
+    if (key_len <= RESPONSE_HEADER_KNOWN_MAX_LEN) {
+        u_char buf[RESPONSE_HEADER_KNOWN_MAX_LEN];
+        ngx_uint_t hash = 0;
+        if (NULL != lowcase_key) {
+            hash = ngx_hash_key((u_char*) lowcase_key, key_len);
+        } else {
+            hash = ngx_hash_strlow(buf, (u_char*) key, key_len);
+            lowcase_key = buf;
+        }
+        response_header_t* rh = ngx_hash_find(&response_headers_hash, hash, (u_char*) lowcase_key, key_len);
+        if (NULL != rh) {
+            return rh->handler(r, rh, value, value_len);
+        }
+    }
+
+    // key and value are copied together
+    ngx_table_elt_t* h = ngx_list_push(&r->headers_out.headers);
+    u_char* data = ngx_pnalloc(r->pool, key_len + value_len);
+    if (NULL == h || NULL == data) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "Header allocation error, size: [%uz]", key_len + value_len);
+        if (NULL != h) {
+            h->hash = 0;
+        }
+        return NGX_ERROR;
+    }
+    h->key.data = data;
+    h->key.len = key_len;
+    h->value.data = ngx_cpymem(data, key, key_len);
+    h->value.len = value_len;
+    ngx_memcpy(h->value.data, value, value_len);
+    h->lowcase_key = NULL;
+    h->hash = 1;
+#if (nginx_version >= 1023000)
+    h->next = NULL;
+#endif
+    return NGX_OK;
+}
+
+#endif /* JSON_HANDLER_RESPONSE_HEADERS_H */
@@ -0,0 +1,305 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_RING_TRANSPORT_H
+#define JSON_HANDLER_RING_TRANSPORT_H
+
+#include "../../include/json_handler_ring.h"
+
+typedef struct ring_transport_s {
+    jh_ring_segment* segment;
+    size_t segment_size;
+    // segment header is writable by handler process,
+    // own copies are used instead
+    uint64_t ring_size;
+    jh_ring* request;
+    jh_ring* response;
+    int memfd;
+    int request_efd;
+    int response_efd;
+    // kept open while handler process serves the rings
+    int sock;
+} ring_transport_t;
+
+typedef struct ring_response_s {
+    uint64_t handle;
+    uint32_t status;
+    uint32_t headers_count;
+    jh_ring_reader headers;
+    const char* body;
+    uint32_t body_len;
+} ring_response_t;
+
+static int ring_response_parse(const char* msg, size_t len, ring_response_t* resp) {
+    if (len < sizeof(uint64_t)) {
+        return -1;
+    }
+    memcpy(&resp->handle, msg, sizeof(uint64_t));
+    jh_ring_reader reader;
+    reader.pos = msg + sizeof(uint64_t);
+    reader.end = msg + len;
+    if (0 != jh_ring_read_u32(&reader, &resp->status)) return -1;
+    if (0 != jh_ring_read_u32(&reader, &resp->headers_count)) return -1;
+    resp->headers = reader;
+    for (uint32_t i = 0; i < resp->headers_count; i++) {
+        const char* data;
+        uint32_t data_len;
+        if (0 != jh_ring_read_bytes(&reader, &data, &data_len)) return -1;
+        if (0 != jh_ring_read_bytes(&reader, &data, &data_len)) return -1;
+    }
+    if (0 != jh_ring_read_bytes(&reader, &resp->body, &resp->body_len)) return -1;
+    return 0;
+}
+
+#if (NGX_LINUX)
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void ring_transport_close(ring_transport_t* rt) {
+    if (NULL != rt->segment) {
+        munmap(rt->segment, rt->segment_size);
+        rt->segment = NULL;
+    }
+    if (-1 != rt->memfd) {
+        close(rt->memfd);
+        rt->memfd = -1;
+    }
+    if (-1 != rt->request_efd) {
+        close(rt->request_efd);
+        rt->request_efd = -1;
+    }
+    if (-1 != rt->response_efd) {
+        close(rt->response_efd);
+        rt->response_efd = -1;
+    }
+    if (-1 != rt->sock) {
+        close(rt->sock);
+        rt->sock = -1;
+    }
+}
+
+static ngx_int_t ring_transport_handshake(ring_transport_t* rt, const char* path, ngx_log_t* log) {
+    struct sockaddr_un addr;
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        ngx_log_error(NGX_LOG_ERR, log, 0, "Ring socket path is too long, path: [%s]", path);
+        return NGX_ERROR;
+    }
+    strcpy(addr.sun_path, path);
+
+    // worker never blocks on the handler process
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (-1 == sock) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno, "Cannot create ring socket");
+        return NGX_ERROR;
+    }
+    if (0 != connect(sock, (struct sockaddr*) &addr, sizeof(addr))) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno, "Cannot connect to ring socket, path: [%s]", path);
+        close(sock);
+        return NGX_ERROR;
+    }
+
+    jh_ring_hello hello;
+    memset(&hello, '\0', sizeof(hello));
+    hello.magic = JH_RING_MAGIC;
+    hello.version = JH_RING_VERSION;
+    hello.pid = (int64_t) ngx_pid;
+
+    struct iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+
+    int fds[3] = { rt->memfd, rt->request_efd, rt->response_efd };
+    union {
+        struct cmsghdr cm;
+        char space[CMSG_SPACE(sizeof(fds))];
+    } cmsg_buf;
+    memset(&cmsg_buf, '\0', sizeof(cmsg_buf));
+
+    struct msghdr msg;
+    memset(&msg, '\0', sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent = sendmsg(sock, &msg, 0);
+    if (sent != (ssize_t) sizeof(hello)) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno, "Cannot send ring descriptors, path: [%s]", path);
+        close(sock);
+        return NGX_ERROR;
+    }
+    rt->sock = sock;
+    return NGX_OK;
+}
+
+static ngx_int_t ring_transport_open(ring_transport_t* rt, const char* path, uint64_t ring_size,
+        ngx_log_t* log) {
+    memset(rt, '\0', sizeof(ring_transport_t));
+    rt->memfd = -1;
+    rt->request_efd = -1;
+    rt->response_efd = -1;
+    rt->sock = -1;
+    rt->segment_size = jh_ring_segment_size(ring_size);
+
+    rt->memfd = memfd_create("json_handler_ring", MFD_CLOEXEC);
+    if (-1 == rt->memfd) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno, "Cannot create ring memfd");
+        ring_transport_close(rt);
+        return NGX_ERROR;
+    }
+    if (0 != ftruncate(rt->memfd, (off_t) rt->segment_size)) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                "Cannot resize ring memfd, size: [%uz]", rt->segment_size);
+        ring_transport_close(rt);
+        return NGX_ERROR;
+    }
+    void* addr = mmap(NULL, rt->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, rt->memfd, 0);
+    if (MAP_FAILED == addr) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                "Cannot map ring memfd, size: [%uz]", rt->segment_size);
+        ring_transport_close(rt);
+        return NGX_ERROR;
+    }
+    rt->segment = addr;
+    jh_ring_segment_init(rt->segment, ring_size);
+    rt->ring_size = ring_size;
+    rt->request = jh_ring_request(rt->segment);
+    rt->response = jh_ring_response(rt->segment);
+    // worker always listens on response doorbell
+    rt->response->waiting = 1;
+
+    rt->request_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    rt->response_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == rt->request_efd || -1 == rt->response_efd) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno, "Cannot create ring eventfd");
+        ring_transport_close(rt);
+        return NGX_ERROR;
+    }
+
+    if (NGX_OK != ring_transport_handshake(rt, path, log)) {
+        ring_transport_close(rt);
+        return NGX_ERROR;
+    }
+
+    // handler process has its own copy now
+    close(rt->memfd);
+    rt->memfd = -1;
+
+    return NGX_OK;
+}
+
+// returns -1 if request ring is full or closed
+static int ring_transport_submit(ring_transport_t* rt, const char* data, size_t len) {
+    if (NULL == rt->segment || len > UINT32_MAX) {
+        return -1;
+    }
+    int rc = jh_ring_write(rt->request, rt->ring_size, data, (uint32_t) len);
+    if (-1 == rc) {
+        return -1;
+    }
+    if (1 == rc) {
+        uint64_t one = 1;
+        if ((ssize_t) sizeof(one) != write(rt->request_efd, &one, sizeof(one)) && NGX_EAGAIN != ngx_errno) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// returns NGX_OK and next response message allocated with malloc,
+// NGX_AGAIN if there are no messages, NGX_ERROR if ring must be closed
+static ngx_int_t ring_transport_receive(ring_transport_t* rt, char** msg, size_t* len, ngx_log_t* log) {
+    if (NULL == rt->segment) {
+        return NGX_AGAIN;
+    }
+    jh_ring* ring = rt->response;
+    uint32_t msg_len;
+    int rc = jh_ring_peek(ring, rt->ring_size, &msg_len);
+    if (0 == rc) {
+        return NGX_AGAIN;
+    }
+    if (1 != rc) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                "Invalid response ring state, head: [%uL], tail: [%uL], size: [%uL]",
+                ring->head, ring->tail, rt->ring_size);
+        return NGX_ERROR;
+    }
+    *msg = malloc(msg_len > 0 ? msg_len : 1);
+    if (NULL == *msg) {
+        ngx_log_error(NGX_LOG_ERR, log, 0, "Ring message allocation error, size: [%uD]", msg_len);
+        return NGX_ERROR;
+    }
+    jh_ring_consume(ring, rt->ring_size, *msg, msg_len);
+    *len = msg_len;
+    return NGX_OK;
+}
+
+static void ring_transport_clear_doorbell(ring_transport_t* rt) {
+    uint64_t count;
+    while ((ssize_t) sizeof(count) == read(rt->response_efd, &count, sizeof(count))) {
+        // no-op
+    }
+}
+
+#else // !NGX_LINUX
+
+static void ring_transport_close(ring_transport_t* rt) {
+    (void) rt;
+}
+
+static ngx_int_t ring_transport_open(ring_transport_t* rt, const char* path, uint64_t ring_size,
+        ngx_log_t* log) {
+    (void) rt;
+    (void) path;
+    (void) ring_size;
+    ngx_log_error(NGX_LOG_ERR, log, 0, "Ring transport is only supported on Linux");
+    return NGX_ERROR;
+}
+
+static int ring_transport_submit(ring_transport_t* rt, const char* data, size_t len) {
+    (void) rt;
+    (void) data;
+    (void) len;
+    return -1;
+}
+
+static ngx_int_t ring_transport_receive(ring_transport_t* rt, char** msg, size_t* len, ngx_log_t* log) {
+    (void) rt;
+    (void) msg;
+    (void) len;
+    (void) log;
+    return NGX_AGAIN;
+}
+
+static void ring_transport_clear_doorbell(ring_transport_t* rt) {
+    (void) rt;
+}
+
+#endif // NGX_LINUX
+
+#endif /* JSON_HANDLER_RING_TRANSPORT_H */
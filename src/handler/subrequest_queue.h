@@ -0,0 +1,113 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_HANDLER_SUBREQUEST_QUEUE_H
+#define JSON_HANDLER_SUBREQUEST_QUEUE_H
+
+// subrequests are enqueued by library threads and issued
+// from the worker event loop after it is woken up through the pipe
+
+typedef struct subrequest_item_s subrequest_item_t;
+
+struct subrequest_item_s {
+    subrequest_item_t* next;
+    long long handle;
+    long long tag;
+    char* uri;
+    char* args;
+};
+
+// lock-free stack, consumer takes all items at once
+static subrequest_item_t* subrequest_queue = NULL;
+static int subrequest_pipe[2] = { -1, -1 };
+
+static char* subrequest_strdup(const char* str) {
+    size_t len = strlen(str);
+    char* res = malloc(len + 1);
+    if (NULL != res) {
+        memcpy(res, str, len + 1);
+    }
+    return res;
+}
+
+static void subrequest_item_free(subrequest_item_t* item) {
+    free(item->uri);
+    free(item->args);
+    free(item);
+}
+
+// thread-safe
+static int subrequest_enqueue(long long handle, const char* uri, const char* args, long long tag) {
+    if (NULL == uri || -1 == subrequest_pipe[1]) {
+        return -1;
+    }
+    subrequest_item_t* item = malloc(sizeof(subrequest_item_t));
+    if (NULL == item) {
+        return -1;
+    }
+    memset(item, '\0', sizeof(subrequest_item_t));
+    item->handle = handle;
+    item->tag = tag;
+    item->uri = subrequest_strdup(uri);
+    item->args = subrequest_strdup(NULL != args ? args : "");
+    if (NULL == item->uri || NULL == item->args) {
+        subrequest_item_free(item);
+        return -1;
+    }
+
+    subrequest_item_t* head = __atomic_load_n(&subrequest_queue, __ATOMIC_RELAXED);
+    do {
+        item->next = head;
+    } while (!__atomic_compare_exchange_n(&subrequest_queue, &head, item, 1,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // pipe is non-blocking, full pipe means that wake up is already pending
+    char wake = 1;
+    ssize_t written = write(subrequest_pipe[1], &wake, 1);
+    (void) written;
+    return 0;
+}
+
+// returns items in submission order
+static subrequest_item_t* subrequest_take_all() {
+    subrequest_item_t* head = __atomic_exchange_n(&subrequest_queue, NULL, __ATOMIC_ACQUIRE);
+    subrequest_item_t* reversed = NULL;
+    while (NULL != head) {
+        subrequest_item_t* next = head->next;
+        head->next = reversed;
+        reversed = head;
+        head = next;
+    }
+    return reversed;
+}
+
+static void subrequest_clear_wake() {
+    char buf[64];
+    while (read(subrequest_pipe[0], buf, sizeof(buf)) > 0) {
+        // no-op
+    }
+}
+
+static void subrequest_pipe_close() {
+    for (int i = 0; i < 2; i++) {
+        if (-1 != subrequest_pipe[i]) {
+            close(subrequest_pipe[i]);
+            subrequest_pipe[i] = -1;
+        }
+    }
+}
+
+#endif /* JSON_HANDLER_SUBREQUEST_QUEUE_H */
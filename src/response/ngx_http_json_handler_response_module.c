@@ -22,6 +22,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../handler/request_ctx.h"
+#include "../handler/coalesce.h"
+#include "../handler/response_headers.h"
+
 #define RESPONSE_HEADER_PREFIX "x-response-"
 
 static ngx_int_t send_buffer(ngx_http_request_t* r, ngx_buf_t* buf) {
@@ -33,6 +37,12 @@ static ngx_int_t send_buffer(ngx_http_request_t* r, ngx_buf_t* buf) {
         return err_headers;
     }
 
+    // HEAD, 204, 304
+    if (r->header_only) {
+        ngx_http_finalize_request(r, NGX_OK);
+        return NGX_OK;
+    }
+
     // send data
     ngx_chain_t chain;
     chain.buf = buf;
@@ -88,43 +98,6 @@ static ngx_http_request_t* find_request_handle(ngx_http_request_t* r) {
     return NULL;
 }
 
-static ngx_int_t copy_single_header(ngx_http_request_t* r, ngx_table_elt_t* hin, size_t prefix_len) {
-
-    // copy key
-    ngx_str_t key;
-    key.len = hin->key.len - prefix_len;
-    key.data = ngx_pcalloc(r->pool, key.len);
-    if (NULL == key.data) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                "Pool allocation error, size: [%l]", key.len);
-        return NGX_ERROR;
-    }
-    memcpy(key.data, hin->key.data + prefix_len, key.len);
-
-    // copy value
-    ngx_str_t value;
-    value.len = hin->value.len;
-    value.data = ngx_pcalloc(r->pool, value.len);
-    if (NULL == value.data) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                "Pool allocation error, size: [%l]", value.len);
-        return NGX_ERROR;
-    }
-    memcpy(value.data, hin->value.data, value.len);
-
-    // set header
-    ngx_table_elt_t* hout = ngx_list_push(&r->headers_out.headers);
-    if (hout == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "Header allocation error");
-        return NGX_ERROR;
-    }
-    hout->key = key;
-    hout->value = value;
-    hout->hash = 1;
-
-    return NGX_OK;
-}
-
 static ngx_int_t copy_headers(ngx_http_request_t* r, ngx_http_request_t* hr) {
     ngx_list_part_t* part = &hr->headers_in.headers.part;
     ngx_table_elt_t* elts = part->elts;
@@ -144,7 +117,8 @@ static ngx_int_t copy_headers(ngx_http_request_t* r, ngx_http_request_t* hr) {
         size_t len = sizeof(RESPONSE_HEADER_PREFIX) - 1;
         if (hin->key.len > len &&
                 0 == strncmp(RESPONSE_HEADER_PREFIX, (const char*) hin->lowcase_key, len)) {
-            ngx_int_t err_copy = copy_single_header(r, hin, len);
+            ngx_int_t err_copy = response_header_set(r, hin->key.data + len, hin->lowcase_key + len,
+                    hin->key.len - len, hin->value.data, hin->value.len);
             if (NGX_OK != err_copy) {
                 return err_copy;
             }
@@ -195,7 +169,8 @@ static ngx_int_t send_client_response(ngx_http_request_t* r, ngx_http_request_t*
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    // headers
+    // headers, 'X-Response-Status' overrides the status
+    r->headers_out.status = NGX_HTTP_OK;
     ngx_int_t err_headers = copy_headers(r, hr);
     if (NGX_OK != err_headers) {
         ngx_http_finalize_request(r, NGX_ERROR);
@@ -215,7 +190,6 @@ static ngx_int_t send_client_response(ngx_http_request_t* r, ngx_http_request_t*
     }
 
     // send
-    r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = buf->last - buf->pos;
 
     ngx_int_t err_send = send_buffer(r, buf);
@@ -239,7 +213,21 @@ static void body_handler(ngx_http_request_t* r) {
     // client response
     ngx_http_request_t* cr = find_request_handle(r);
     if (NULL != cr) {
+        // coalesced requests waiting for the same response,
+        // must be taken before client request is finalized
+        ngx_queue_t waiters;
+        json_handler_ctx_t* ctx = ngx_http_get_module_ctx(cr, ngx_http_json_handler_module);
+        coalesce_detach(ctx, &waiters);
+
         status = send_client_response(cr, r);
+
+        while (!ngx_queue_empty(&waiters)) {
+            ngx_queue_t* q = ngx_queue_head(&waiters);
+            ngx_queue_remove(q);
+            json_handler_ctx_t* w = ngx_queue_data(q, json_handler_ctx_t, coalesce_queue);
+            w->coalesce_waiting = 0;
+            send_client_response(w->request, r);
+        }
     } else {
         status = NGX_HTTP_BAD_REQUEST;
     }
@@ -292,9 +280,13 @@ static ngx_command_t conf_desc[] = {
     ngx_null_command /* command termination */
 };
 
+static ngx_int_t postconfiguration(ngx_conf_t* cf) {
+    return response_headers_init(cf);
+}
+
 static ngx_http_module_t module_ctx = {
     NULL, /* preconfiguration */
-    NULL, /* postconfiguration */
+    postconfiguration, /* postconfiguration */
 
     NULL, /* create main configuration */
     NULL, /* init main configuration */
@@ -0,0 +1,453 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Standalone checks for nginx-independent helpers: incremental JSON
+ * validator, JSON Pointer extractor and binary envelope writer (read back
+ * with the reader from json_handler_envelope.h).
+ *
+ * cc -std=gnu99 -Wall -I../include -I../src/handler -o handler_checks handler_checks.c -ljansson
+ * ./handler_checks
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+
+#include "json_handler_envelope.h"
+
+#include "json_validator.h"
+#include "json_extract.h"
+#include "envelope_writer.h"
+
+static int failures = 0;
+
+#define CHECK(cond, name) check(cond, name, __LINE__)
+
+static void check(int cond, const char* name, int line) {
+    if (!cond) {
+        fprintf(stderr, "FAIL: line %d: %s\n", line, name);
+        failures += 1;
+    }
+}
+
+// validator
+
+// returns 1 if input is accepted, both as a single chunk and byte by byte
+static int validate(const char* json) {
+    size_t len = strlen(json);
+    json_validator_t* whole = malloc(sizeof(json_validator_t));
+    json_validator_t* bytes = malloc(sizeof(json_validator_t));
+    json_validator_init(whole);
+    json_validator_init(bytes);
+    int res_whole = 0 == json_validator_feed(whole, (const unsigned char*) json, len) &&
+            json_validator_complete(whole);
+    for (size_t i = 0; i < len; i++) {
+        json_validator_feed(bytes, (const unsigned char*) json + i, 1);
+    }
+    int res_bytes = JV_ERROR != bytes->state && json_validator_complete(bytes);
+    CHECK(res_whole == res_bytes, json);
+    free(whole);
+    free(bytes);
+    return res_whole;
+}
+
+static char* nested_arrays(size_t depth) {
+    char* res = malloc(depth * 2 + 1);
+    memset(res, '[', depth);
+    memset(res + depth, ']', depth);
+    res[depth * 2] = '\0';
+    return res;
+}
+
+static void check_validator() {
+    // accepted
+    CHECK(validate("{}"), "empty object");
+    CHECK(validate("[]"), "empty array");
+    CHECK(validate(" \t\r\n{ } \n"), "surrounding whitespace");
+    CHECK(validate("{\"a\":[1,-0,0.5,-12.25e+3,1E-2,1e5,true,false,null]}"), "scalars");
+    CHECK(validate("[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\uD83D\\uDE00\"]"), "escapes");
+    CHECK(validate("[\"\xc3\xa9\"]"), "raw UTF-8");
+    CHECK(validate("{\"a\":{\"b\":{\"c\":[[],{}]}},\"d\":1}"), "nested");
+    CHECK(validate("[1]"), "number before bracket");
+    CHECK(validate("{\"a\":1}"), "number before brace");
+    CHECK(validate("[1 ,2\n]"), "number before whitespace");
+    CHECK(validate("\"str\""), "top-level string");
+    CHECK(validate("42"), "top-level number");
+    CHECK(validate("0"), "top-level zero");
+    CHECK(validate(" -1.5e3 "), "top-level number with whitespace");
+    CHECK(validate("null"), "top-level literal");
+
+    // rejected
+    CHECK(!validate(""), "empty input");
+    CHECK(!validate("   "), "whitespace only");
+    CHECK(!validate("1 2"), "two top-level values");
+    CHECK(!validate("01"), "top-level leading zero");
+    CHECK(!validate("\"a\" x"), "garbage after top-level string");
+    CHECK(!validate("{} {}"), "trailing value");
+    CHECK(!validate("[] x"), "trailing garbage");
+    CHECK(!validate("[01]"), "leading zero");
+    CHECK(!validate("[-]"), "minus only");
+    CHECK(!validate("[1.]"), "empty fraction");
+    CHECK(!validate("[.5]"), "no integer part");
+    CHECK(!validate("[1e]"), "empty exponent");
+    CHECK(!validate("[1e+]"), "exponent sign only");
+    CHECK(!validate("[+1]"), "plus sign");
+    CHECK(!validate("[tru]"), "short literal");
+    CHECK(!validate("[nul1]"), "broken literal");
+    CHECK(!validate("[True]"), "literal case");
+    CHECK(!validate("[1,]"), "trailing comma in array");
+    CHECK(!validate("{\"a\":1,}"), "trailing comma in object");
+    CHECK(!validate("[,1]"), "leading comma");
+    CHECK(!validate("{\"a\" 1}"), "missing colon");
+    CHECK(!validate("{\"a\":}"), "missing value");
+    CHECK(!validate("{a:1}"), "unquoted key");
+    CHECK(!validate("{1:1}"), "number key");
+    CHECK(!validate("[1}"), "mismatched brace");
+    CHECK(!validate("{\"a\":1]"), "mismatched bracket");
+    CHECK(!validate("]"), "close without open");
+    CHECK(!validate("[\"\\x\"]"), "unknown escape");
+    CHECK(!validate("[\"\\u12g4\"]"), "bad unicode escape");
+    CHECK(!validate("[\"a\tb\"]"), "control character");
+
+    // incomplete
+    CHECK(!validate("{\"a\":"), "unfinished object");
+    CHECK(!validate("[1"), "unfinished array");
+    CHECK(!validate("[\"abc"), "unfinished string");
+    CHECK(!validate("[\"\\u00"), "unfinished escape");
+    CHECK(!validate("-"), "unfinished top-level number");
+    CHECK(!validate("1."), "unfinished top-level fraction");
+    CHECK(!validate("1e+"), "unfinished top-level exponent");
+    CHECK(!validate("tru"), "unfinished top-level literal");
+
+    // depth limit
+    char* deep = nested_arrays(JSON_VALIDATOR_MAX_DEPTH);
+    CHECK(validate(deep), "max depth");
+    free(deep);
+    char* too_deep = nested_arrays(JSON_VALIDATOR_MAX_DEPTH + 1);
+    CHECK(!validate(too_deep), "depth over limit");
+    free(too_deep);
+}
+
+// extractor
+
+// 'pointer' is a list of unescaped tokens separated with '\0', ended with empty token,
+// returns NULL if value is not found, 'err' is optional
+static char* extract(const char* json, const char* pointer, int* err) {
+    json_pointer_token_t tokens[16];
+    size_t count = 0;
+    for (const char* t = pointer; '\0' != *t; t += strlen(t) + 1) {
+        tokens[count].data = t;
+        tokens[count].len = strlen(t);
+        count += 1;
+    }
+    const char* value = NULL;
+    size_t value_len = 0;
+    int rc = json_extract(json, strlen(json), tokens, count, &value, &value_len);
+    if (NULL != err) {
+        *err = rc;
+    }
+    if (0 != rc) {
+        return NULL;
+    }
+    char* res = malloc(value_len + 1);
+    memcpy(res, value, value_len);
+    res[value_len] = '\0';
+    return res;
+}
+
+static void check_extract(const char* json, const char* pointer, const char* expected, const char* name) {
+    char* value = extract(json, pointer, NULL);
+    if (NULL == expected) {
+        CHECK(NULL == value, name);
+    } else {
+        CHECK(NULL != value && 0 == strcmp(expected, value), name);
+    }
+    free(value);
+}
+
+static void check_extract_duplicate(const char* json, const char* pointer, const char* name) {
+    int err = 0;
+    char* value = extract(json, pointer, &err);
+    CHECK(NULL == value && JSON_EXTRACT_DUPLICATE == err, name);
+    free(value);
+}
+
+static void check_extractor() {
+    const char* doc =
+            "{\n"
+            "  \"skip\": {\"x\": \"}]\\\"{[\", \"y\": [1, [2, {\"z\": \"\\\\\"}]]},\n"
+            "  \"a~b\": 1,\n"
+            "  \"c/d\": 2,\n"
+            "  \"\\u00e9\": 3,\n"
+            "  \"\\ud83d\\ude00\": 4,\n"
+            "  \"q\\\"k\": 5,\n"
+            "  \"tab\\tkey\": 6,\n"
+            "  \"\": 7,\n"
+            "  \"arr\": [10, {\"x\": [true]}, \"s\" , -1.5e3],\n"
+            "  \"n\": {\"m\": null},\n"
+            "  \"s\": \"text\",\n"
+            "  \"dup\": 1,\n"
+            "  \"dup\": 2\n"
+            "}";
+
+    check_extract(doc, "", doc, "empty pointer is whole document");
+    check_extract(doc, "skip\0y\0" "1\0" "1\0z\0", "\"\\\\\"", "nested value");
+    check_extract(doc, "a~b\0", "1", "tilde in key");
+    check_extract(doc, "c/d\0", "2", "slash in key");
+    check_extract(doc, "\xc3\xa9\0", "3", "unicode escape in key");
+    check_extract(doc, "\xf0\x9f\x98\x80\0", "4", "surrogate pair in key");
+    check_extract(doc, "q\"k\0", "5", "escaped quote in key");
+    check_extract(doc, "tab\tkey\0", "6", "escaped tab in key");
+    check_extract(doc, "arr\0" "0\0", "10", "first index");
+    check_extract(doc, "arr\0" "1\0x\0" "0\0", "true", "index inside object inside array");
+    check_extract(doc, "arr\0" "2\0", "\"s\"", "string element");
+    check_extract(doc, "arr\0" "3\0", "-1.5e3", "last element");
+    check_extract(doc, "arr\0" "1\0", "{\"x\": [true]}", "container value");
+    check_extract(doc, "n\0m\0", "null", "null value");
+
+    check_extract(doc, "missing\0", NULL, "missing key");
+    check_extract(doc, "A~B\0", NULL, "key is case-sensitive");
+    check_extract(doc, "a~b~\0", NULL, "key prefix");
+    check_extract(doc, "arr\0" "4\0", NULL, "index out of range");
+    check_extract(doc, "arr\0" "01\0", NULL, "leading zero index");
+    check_extract(doc, "arr\0-\0", NULL, "past-the-end index");
+    check_extract(doc, "arr\0x\0", NULL, "key on array");
+    check_extract(doc, "arr\0" "99999999999999999999\0", NULL, "too long index");
+    check_extract(doc, "s\0" "0\0", NULL, "scalar on the path");
+    check_extract(doc, "n\0m\0x\0", NULL, "null on the path");
+
+    check_extract("[[1,2],[3,[4,5]]]", "1\0" "1\0" "0\0", "4", "nested arrays");
+    check_extract("[\"]\", \"x\"]", "1\0", "\"x\"", "bracket inside string");
+    check_extract("{\"a\":{}}", "a\0b\0", NULL, "empty object");
+    check_extract("{\"a\":[]}", "a\0" "0\0", NULL, "empty array");
+    check_extract("{\"a\":1", "a\0", "1", "unterminated document");
+    check_extract("{\"a\":\"x", "a\0", NULL, "truncated string");
+    check_extract("{\"a\":[1,", "a\0" "1\0", NULL, "truncated array");
+
+    // rejected by the parser, body is not a json
+    check_extract_duplicate(doc, "dup\0", "duplicate key");
+    check_extract_duplicate("{\"a\":{\"b\":1},\"a\":{\"b\":2}}", "a\0b\0", "duplicate key on the path");
+    check_extract_duplicate("{\"a\":{\"b\":1,\"b\":2}}", "a\0b\0", "duplicate nested key");
+    check_extract_duplicate("{\"\\u0061\":1,\"a\":2}", "a\0", "duplicate escaped key");
+    check_extract("{\"a\":1,\"b\":1,\"b\":2}", "a\0", "1", "duplicate key off the path");
+}
+
+// envelope
+
+static int read_item(jh_envelope_reader* reader, jh_envelope_item* item, int type) {
+    return type == jh_envelope_read(reader, item);
+}
+
+static int read_string(jh_envelope_reader* reader, const char* expected, size_t len) {
+    jh_envelope_item item;
+    return read_item(reader, &item, JH_ITEM_STRING) && len == item.len && 0 == memcmp(expected, item.data, len);
+}
+
+static int read_int(jh_envelope_reader* reader, long long expected) {
+    jh_envelope_item item;
+    return read_item(reader, &item, JH_ITEM_INT) && expected == item.int_value;
+}
+
+static const long long envelope_ints[] = {
+    0, 1, 23, 24, 127, 128, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL, INT64_MAX,
+    -1, -24, -25, -32, -33, -128, -129, -65536, -4294967296LL, INT64_MIN
+};
+
+static const size_t envelope_string_lens[] = { 0, 1, 23, 24, 31, 32, 255, 256, 65535, 65536 };
+
+#define ARRAY_LEN(arr) (sizeof(arr) / sizeof(arr[0]))
+
+static void write_primitives(envelope_t* env, const char* text) {
+    envelope_map(env, 8);
+
+    envelope_cstring(env, "ints");
+    envelope_array(env, ARRAY_LEN(envelope_ints));
+    for (size_t i = 0; i < ARRAY_LEN(envelope_ints); i++) {
+        envelope_int(env, envelope_ints[i]);
+    }
+
+    envelope_cstring(env, "strings");
+    envelope_array(env, ARRAY_LEN(envelope_string_lens));
+    for (size_t i = 0; i < ARRAY_LEN(envelope_string_lens); i++) {
+        envelope_string(env, text, envelope_string_lens[i]);
+    }
+
+    envelope_cstring(env, "bytes");
+    envelope_bytes(env, (const unsigned char*) "\x00\xff\x80\xc3", 4);
+
+    envelope_cstring(env, "double");
+    envelope_double(env, -0.125);
+
+    envelope_cstring(env, "true");
+    envelope_bool(env, 1);
+
+    envelope_cstring(env, "false");
+    envelope_bool(env, 0);
+
+    envelope_cstring(env, "null");
+    envelope_null(env);
+
+    // more than 15 entries
+    envelope_cstring(env, "map");
+    envelope_map(env, 16);
+    for (int i = 0; i < 16; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        envelope_cstring(env, key);
+        envelope_int(env, i);
+    }
+}
+
+static void check_primitives(jh_envelope_reader* reader, const char* text, const char* name) {
+    jh_envelope_item item;
+    CHECK(read_item(reader, &item, JH_ITEM_MAP) && 8 == item.count, name);
+
+    CHECK(read_string(reader, "ints", 4), name);
+    CHECK(read_item(reader, &item, JH_ITEM_ARRAY) && ARRAY_LEN(envelope_ints) == item.count, name);
+    for (size_t i = 0; i < ARRAY_LEN(envelope_ints); i++) {
+        CHECK(read_int(reader, envelope_ints[i]), name);
+    }
+
+    CHECK(read_string(reader, "strings", 7), name);
+    CHECK(read_item(reader, &item, JH_ITEM_ARRAY) && ARRAY_LEN(envelope_string_lens) == item.count, name);
+    for (size_t i = 0; i < ARRAY_LEN(envelope_string_lens); i++) {
+        CHECK(read_string(reader, text, envelope_string_lens[i]), name);
+    }
+
+    CHECK(read_string(reader, "bytes", 5), name);
+    CHECK(read_item(reader, &item, JH_ITEM_BYTES) && 4 == item.len &&
+            0 == memcmp("\x00\xff\x80\xc3", item.data, 4), name);
+
+    CHECK(read_string(reader, "double", 6), name);
+    CHECK(read_item(reader, &item, JH_ITEM_DOUBLE) && -0.125 == item.double_value, name);
+
+    CHECK(read_string(reader, "true", 4), name);
+    CHECK(read_item(reader, &item, JH_ITEM_BOOL) && 1 == item.bool_value, name);
+
+    CHECK(read_string(reader, "false", 5), name);
+    CHECK(read_item(reader, &item, JH_ITEM_BOOL) && 0 == item.bool_value, name);
+
+    CHECK(read_string(reader, "null", 4), name);
+    CHECK(read_item(reader, &item, JH_ITEM_NULL), name);
+
+    CHECK(read_string(reader, "map", 3), name);
+    CHECK(read_item(reader, &item, JH_ITEM_MAP) && 16 == item.count, name);
+    for (int i = 0; i < 16; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        CHECK(read_string(reader, key, strlen(key)), name);
+        CHECK(read_int(reader, i), name);
+    }
+
+    CHECK(read_item(reader, &item, JH_ITEM_END), name);
+}
+
+static void check_json(jh_envelope_reader* reader, const char* name) {
+    jh_envelope_item item;
+    CHECK(read_item(reader, &item, JH_ITEM_MAP) && 2 == item.count, name);
+    CHECK(read_string(reader, "a", 1), name);
+    CHECK(read_item(reader, &item, JH_ITEM_ARRAY) && 5 == item.count, name);
+    CHECK(read_int(reader, -7), name);
+    CHECK(read_item(reader, &item, JH_ITEM_DOUBLE) && 2.5 == item.double_value, name);
+    CHECK(read_string(reader, "\xc3\xa9", 2), name);
+    CHECK(read_item(reader, &item, JH_ITEM_BOOL) && 0 == item.bool_value, name);
+    CHECK(read_item(reader, &item, JH_ITEM_NULL), name);
+    CHECK(read_string(reader, "b", 1), name);
+    CHECK(read_item(reader, &item, JH_ITEM_MAP) && 0 == item.count, name);
+    CHECK(read_item(reader, &item, JH_ITEM_END), name);
+}
+
+// every strict prefix of a valid envelope must be rejected
+static void check_truncated(const envelope_t* env, const char* name) {
+    for (size_t len = 0; len < env->len; len++) {
+        jh_envelope_reader reader;
+        jh_envelope_reader_init(&reader, env->format, (const char*) env->buf, len);
+        CHECK(0 != jh_envelope_skip(&reader), name);
+    }
+    jh_envelope_reader reader;
+    jh_envelope_reader_init(&reader, env->format, (const char*) env->buf, env->len);
+    CHECK(0 == jh_envelope_skip(&reader) && reader.pos == reader.end, name);
+}
+
+static void check_envelope_format(int format, const char* name) {
+    size_t text_len = 65536;
+    char* text = malloc(text_len);
+    for (size_t i = 0; i < text_len; i++) {
+        text[i] = (char) ('a' + i % 26);
+    }
+
+    envelope_t env;
+    envelope_init(&env, format);
+    write_primitives(&env, text);
+    CHECK(!env.failed, name);
+    jh_envelope_reader reader;
+    jh_envelope_reader_init(&reader, format, (const char*) env.buf, env.len);
+    check_primitives(&reader, text, name);
+    check_truncated(&env, name);
+    envelope_free(&env);
+
+    // {"a": [-7, 2.5, "\u00e9", false, null], "b": {}}
+    json_t* arr = json_array();
+    json_array_append_new(arr, json_integer(-7));
+    json_array_append_new(arr, json_real(2.5));
+    json_array_append_new(arr, json_string("\xc3\xa9"));
+    json_array_append_new(arr, json_false());
+    json_array_append_new(arr, json_null());
+    json_t* json = json_object();
+    json_object_set_new(json, "a", arr);
+    json_object_set_new(json, "b", json_object());
+    envelope_init(&env, format);
+    envelope_json(&env, json);
+    CHECK(!env.failed, name);
+    jh_envelope_reader_init(&reader, format, (const char*) env.buf, env.len);
+    check_json(&reader, name);
+    check_truncated(&env, name);
+    envelope_free(&env);
+    json_decref(json);
+
+    free(text);
+}
+
+static void check_envelope() {
+    check_envelope_format(ENVELOPE_CBOR, "cbor");
+    check_envelope_format(ENVELOPE_MSGPACK, "msgpack");
+
+    // reserved and indefinite-length heads
+    jh_envelope_reader reader;
+    jh_envelope_item item;
+    jh_envelope_reader_init(&reader, JH_ENVELOPE_CBOR, "\x9f\xff", 2);
+    CHECK(read_item(&reader, &item, JH_ITEM_ERROR), "cbor indefinite array");
+    jh_envelope_reader_init(&reader, JH_ENVELOPE_MSGPACK, "\xc1", 1);
+    CHECK(read_item(&reader, &item, JH_ITEM_ERROR), "msgpack reserved head");
+    jh_envelope_reader_init(&reader, JH_ENVELOPE_MSGPACK, "\xcf\xff\xff\xff\xff\xff\xff\xff\xff", 9);
+    CHECK(read_item(&reader, &item, JH_ITEM_ERROR), "msgpack uint64 over int64");
+}
+
+int main() {
+    check_validator();
+    check_extractor();
+    check_envelope();
+    if (0 != failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    puts("OK");
+    return 0;
+}
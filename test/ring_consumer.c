@@ -0,0 +1,279 @@
+/*
+ * Copyright 2021, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stub handler process for 'json_handler_ring' transport, responds to every
+ * request with its envelope (same as test library does).
+ *
+ * cc -std=gnu99 -I../include -o ring_consumer ring_consumer.c
+ * ./ring_consumer /tmp/json_handler.sock [json|cbor|msgpack]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "json_handler_envelope.h"
+#include "json_handler_ring.h"
+
+#define MAX_WORKERS 64
+
+typedef struct worker {
+    // closed when this process exits
+    int conn;
+    jh_ring_segment* segment;
+    size_t segment_size;
+    int request_efd;
+    int response_efd;
+} worker;
+
+static worker workers[MAX_WORKERS];
+static size_t workers_count = 0;
+static int envelope_format = 0;
+
+static int accept_worker(int listen_fd) {
+    int conn = accept(listen_fd, NULL, NULL);
+    if (-1 == conn) {
+        return -1;
+    }
+
+    jh_ring_hello hello;
+    struct iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    int fds[3];
+    union {
+        struct cmsghdr cm;
+        char space[CMSG_SPACE(sizeof(fds))];
+    } cmsg_buf;
+    struct msghdr msg;
+    memset(&msg, '\0', sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    ssize_t received = recvmsg(conn, &msg, 0);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (received != (ssize_t) sizeof(hello) || JH_RING_MAGIC != hello.magic ||
+            NULL == cmsg || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) ||
+            workers_count >= MAX_WORKERS) {
+        fprintf(stderr, "invalid worker handshake\n");
+        close(conn);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    struct stat st;
+    fstat(fds[0], &st);
+    void* addr = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (MAP_FAILED == addr) {
+        perror("mmap");
+        close(conn);
+        return -1;
+    }
+
+    // worker treats closed connection as handler exit
+    worker* w = &workers[workers_count++];
+    w->conn = conn;
+    w->segment = addr;
+    w->segment_size = (size_t) st.st_size;
+    w->request_efd = fds[1];
+    w->response_efd = fds[2];
+    fprintf(stderr, "worker connected, pid: [%lld]\n", (long long) hello.pid);
+    return 0;
+}
+
+static long long find_handle_json(const char* req, size_t len) {
+    const char* key = "\"requestHandle\"";
+    const char* found = memmem(req, len, key, strlen(key));
+    if (NULL == found) {
+        return 0;
+    }
+    found = memchr(found, ':', len - (size_t) (found - req));
+    return NULL != found ? strtoll(found + 1, NULL, 10) : 0;
+}
+
+static int find_key(jh_envelope_reader* reader, const char* key) {
+    jh_envelope_item item;
+    if (JH_ITEM_MAP != jh_envelope_read(reader, &item)) {
+        return -1;
+    }
+    for (size_t i = 0; i < item.count; i++) {
+        jh_envelope_item key_item;
+        if (JH_ITEM_STRING != jh_envelope_read(reader, &key_item)) {
+            return -1;
+        }
+        if (key_item.len == strlen(key) && 0 == memcmp(key_item.data, key, key_item.len)) {
+            return 0;
+        }
+        if (0 != jh_envelope_skip(reader)) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static long long find_handle_binary(const char* req, size_t len) {
+    jh_envelope_reader reader;
+    jh_envelope_reader_init(&reader, envelope_format, req, len);
+    jh_envelope_item item;
+    if (0 != find_key(&reader, "meta") || 0 != find_key(&reader, "requestHandle") ||
+            JH_ITEM_INT != jh_envelope_read(&reader, &item)) {
+        return 0;
+    }
+    return item.int_value;
+}
+
+static void put_bytes(char** pos, const char* data, uint32_t len) {
+    memcpy(*pos, &len, sizeof(len));
+    *pos += sizeof(len);
+    memcpy(*pos, data, len);
+    *pos += len;
+}
+
+static void respond(worker* w, const char* req, uint32_t len) {
+    uint64_t handle = (uint64_t) (0 == envelope_format ?
+            find_handle_json(req, len) : find_handle_binary(req, len));
+    if (0 == handle) {
+        fprintf(stderr, "request handle not found\n");
+        return;
+    }
+
+    const char* headers[] = {
+        "Content-Type", 0 == envelope_format ? "application/json" : "application/octet-stream",
+        "Foo", "Bar"
+    };
+    uint32_t headers_count = 2;
+    size_t resp_len = sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(uint32_t) + len;
+    for (size_t i = 0; i < headers_count * 2; i++) {
+        resp_len += sizeof(uint32_t) + strlen(headers[i]);
+    }
+    char* resp = malloc(resp_len);
+    char* pos = resp;
+    uint32_t status = 200;
+    memcpy(pos, &handle, sizeof(handle));
+    pos += sizeof(handle);
+    memcpy(pos, &status, sizeof(status));
+    pos += sizeof(status);
+    memcpy(pos, &headers_count, sizeof(headers_count));
+    pos += sizeof(headers_count);
+    for (size_t i = 0; i < headers_count * 2; i++) {
+        put_bytes(&pos, headers[i], (uint32_t) strlen(headers[i]));
+    }
+    put_bytes(&pos, req, len);
+
+    jh_ring* ring = jh_ring_response(w->segment);
+    int rc;
+    while (-1 == (rc = jh_ring_write(ring, w->segment->ring_size, resp, (uint32_t) resp_len))) {
+        usleep(100);
+    }
+    free(resp);
+    if (1 == rc) {
+        uint64_t one = 1;
+        if (sizeof(one) != (size_t) write(w->response_efd, &one, sizeof(one))) {
+            perror("write");
+        }
+    }
+}
+
+static void drain(worker* w) {
+    jh_ring* ring = jh_ring_request(w->segment);
+    uint64_t size = w->segment->ring_size;
+    uint32_t len;
+    int rc;
+    while (1 == (rc = jh_ring_peek(ring, size, &len))) {
+        char* req = malloc(len > 0 ? len : 1);
+        jh_ring_consume(ring, size, req, len);
+        respond(w, req, len);
+        free(req);
+    }
+    if (-1 == rc) {
+        fprintf(stderr, "request ring is corrupted\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <socket path> [json|cbor|msgpack]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2 && 0 == strcmp("cbor", argv[2])) {
+        envelope_format = JH_ENVELOPE_CBOR;
+    } else if (argc > 2 && 0 == strcmp("msgpack", argv[2])) {
+        envelope_format = JH_ENVELOPE_MSGPACK;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    unlink(argv[1]);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == listen_fd || 0 != bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) ||
+            0 != listen(listen_fd, MAX_WORKERS)) {
+        perror("listen");
+        return 1;
+    }
+
+    for (;;) {
+        // sleep only when all request rings are empty
+        int pending = 0;
+        for (size_t i = 0; i < workers_count; i++) {
+            drain(&workers[i]);
+            pending |= jh_ring_prepare_wait(jh_ring_request(workers[i].segment));
+        }
+
+        struct pollfd pfds[MAX_WORKERS + 1];
+        pfds[0].fd = listen_fd;
+        pfds[0].events = POLLIN;
+        for (size_t i = 0; i < workers_count; i++) {
+            pfds[i + 1].fd = workers[i].request_efd;
+            pfds[i + 1].events = POLLIN;
+        }
+        int rc = poll(pfds, workers_count + 1, pending ? 0 : -1);
+        if (-1 == rc && EINTR != errno) {
+            perror("poll");
+            return 1;
+        }
+
+        for (size_t i = 0; i < workers_count; i++) {
+            jh_ring_cancel_wait(jh_ring_request(workers[i].segment));
+            uint64_t count;
+            if (rc > 0 && (pfds[i + 1].revents & POLLIN)) {
+                if (sizeof(count) != (size_t) read(workers[i].request_efd, &count, sizeof(count))) {
+                    perror("read");
+                }
+            }
+        }
+        if (rc > 0 && (pfds[0].revents & POLLIN)) {
+            accept_worker(listen_fd);
+        }
+    }
+
+    return 0;
+}
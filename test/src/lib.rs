@@ -32,7 +32,9 @@ struct Data {
     json: std::option::Option<serde_json::Value>,
     string: std::option::Option<std::string::String>,
     stringHex: std::option::Option<std::string::String>,
-    file: std::option::Option<std::string::String>
+    file: std::option::Option<std::string::String>,
+    fd: std::option::Option<i32>,
+    extracted: std::option::Option<serde_json::Value>
 }
 
 #[derive(serde_derive::Serialize, serde_derive::Deserialize)]
@@ -42,26 +44,321 @@ struct Request {
     data: Data
 }
 
+fn post_response(handle: i64, body: std::vec::Vec<u8>, content_type: &str) {
+    let client = reqwest::blocking::Client::new();
+    match client.post("http://127.0.0.1:80/test_response")
+            .body(body)
+            .header("X-Nginx-Request-Handle", handle.to_string())
+            .header("X-Response-Content-Type", content_type)
+            .header("X-Response-Foo", "Bar")
+            .send() {
+        Ok(_) => (),
+        Err(e) => {
+            eprintln!("{}", String::from(e.to_string()))
+        }
+    }
+}
+
+#[allow(non_snake_case)]
+#[derive(serde_derive::Serialize, serde_derive::Deserialize)]
+struct SubrequestResponse {
+    requestHandle: i64,
+    tag: i64,
+    status: i32,
+    headers: serde_json::Value,
+    body: std::option::Option<std::string::String>,
+    bodyHex: std::option::Option<std::string::String>
+}
+
+#[repr(C)]
+pub struct JsonHandlerApi {
+    subrequest: extern "C" fn(i64, *const std::os::raw::c_char, *const std::os::raw::c_char, i64) -> std::os::raw::c_int
+}
+
+// static in nginx module
+static API: std::sync::atomic::AtomicPtr<JsonHandlerApi> = std::sync::atomic::AtomicPtr::new(std::ptr::null_mut());
+
+const SUBREQUEST_TAG: i64 = 42;
+
+#[no_mangle]
+pub extern "C"
+fn init_json_handler(api: *const JsonHandlerApi) -> std::os::raw::c_int {
+    API.store(api as *mut JsonHandlerApi, std::sync::atomic::Ordering::SeqCst);
+    return 0;
+}
+
+// requests with 'X-Subrequest-Uri' header are answered with the result
+// of a subrequest to that URI, see 'receive_subrequest_response'
 #[no_mangle]
 pub extern "C"
 fn submit_json_request(req_json: *const std::os::raw::c_char) -> std::os::raw::c_int {
     let c_str: &std::ffi::CStr = unsafe { std::ffi::CStr::from_ptr(req_json) };
     let json: Request = serde_json::from_slice(c_str.to_bytes()).unwrap();
+    if let Some(uri) = request_header(&json, "X-Subrequest-Uri") {
+        let api = API.load(std::sync::atomic::Ordering::SeqCst);
+        if api.is_null() {
+            return -1;
+        }
+        let uri_c = std::ffi::CString::new(uri.as_str()).unwrap();
+        let args_c = std::ffi::CString::new(json.meta.args.as_str()).unwrap();
+        return unsafe { ((*api).subrequest)(json.meta.requestHandle, uri_c.as_ptr(), args_c.as_ptr(), SUBREQUEST_TAG) };
+    }
     std::thread::spawn(move || {
         let st = serde_json::to_string_pretty(&json).unwrap();
         //eprintln!("{}", st);
-        let client = reqwest::blocking::Client::new();
-        match client.post("http://127.0.0.1:80/test_response")
-                .body(st)
-                .header("X-Nginx-Request-Handle", json.meta.requestHandle.to_string())
-                .header("X-Response-Content-Type", "application/json")
-                .header("X-Response-Foo", "Bar")
-                .send() {
-            Ok(_) => (),
-            Err(e) => {
-                eprintln!("{}", String::from(e.to_string()))
+        post_response(json.meta.requestHandle, st.into_bytes(), "application/json");
+    });
+    return 0;
+}
+
+// called on nginx worker thread, response is posted from another one
+#[no_mangle]
+pub extern "C"
+fn receive_subrequest_response(resp_json: *const std::os::raw::c_char) {
+    let c_str: &std::ffi::CStr = unsafe { std::ffi::CStr::from_ptr(resp_json) };
+    let json: SubrequestResponse = serde_json::from_slice(c_str.to_bytes()).unwrap();
+    if SUBREQUEST_TAG != json.tag {
+        eprintln!("Unexpected subrequest tag: {}", json.tag);
+    }
+    std::thread::spawn(move || {
+        let st = serde_json::to_string_pretty(&json).unwrap();
+        post_response(json.requestHandle, st.into_bytes(), "application/json");
+    });
+}
+
+fn request_header<'a>(req: &'a Request, name: &str) -> std::option::Option<&'a std::string::String> {
+    req.headers.iter()
+        .find(|&(key, _)| key.eq_ignore_ascii_case(name))
+        .map(|(_, value)| value)
+}
+
+#[repr(C)]
+pub struct JsonHandlerHeader {
+    key: *const std::os::raw::c_char,
+    key_len: usize,
+    value: *const std::os::raw::c_char,
+    value_len: usize
+}
+
+#[repr(C)]
+pub struct JsonHandlerResponse {
+    status: std::os::raw::c_int,
+    headers: *const JsonHandlerHeader,
+    headers_count: usize,
+    body: *const std::os::raw::c_char,
+    body_len: usize,
+    release: std::option::Option<extern "C" fn(*mut JsonHandlerResponse)>,
+    release_data: *mut std::os::raw::c_void
+}
+
+// owns the memory 'JsonHandlerResponse' points to
+struct SyncResponse {
+    headers: std::vec::Vec<JsonHandlerHeader>,
+    body: std::string::String
+}
+
+static SYNC_HEADERS: [(&str, &str); 2] = [
+    ("Content-Type", "application/json"),
+    ("X-Response-Sync", "true")
+];
+
+extern "C" fn release_sync_response(resp: *mut JsonHandlerResponse) {
+    unsafe {
+        drop(Box::from_raw((*resp).release_data as *mut SyncResponse));
+    }
+}
+
+// responds in place to requests with 'X-Sync-Response' header,
+// others are declined and go to 'submit_json_request'
+#[no_mangle]
+pub extern "C"
+fn handle_json_request_sync(req_json: *const std::os::raw::c_char, resp: *mut JsonHandlerResponse) -> std::os::raw::c_int {
+    let c_str: &std::ffi::CStr = unsafe { std::ffi::CStr::from_ptr(req_json) };
+    let json: Request = serde_json::from_slice(c_str.to_bytes()).unwrap();
+    if request_header(&json, "X-Sync-Response").is_none() {
+        return 1;
+    }
+    let headers = SYNC_HEADERS.iter().map(|&(key, value)| JsonHandlerHeader {
+        key: key.as_ptr() as *const std::os::raw::c_char,
+        key_len: key.len(),
+        value: value.as_ptr() as *const std::os::raw::c_char,
+        value_len: value.len()
+    }).collect();
+    let owned = Box::new(SyncResponse {
+        headers: headers,
+        body: serde_json::to_string_pretty(&json).unwrap()
+    });
+    unsafe {
+        (*resp).status = 200;
+        (*resp).headers = owned.headers.as_ptr();
+        (*resp).headers_count = owned.headers.len();
+        (*resp).body = owned.body.as_ptr() as *const std::os::raw::c_char;
+        (*resp).body_len = owned.body.len();
+        (*resp).release = Some(release_sync_response);
+        (*resp).release_data = Box::into_raw(owned) as *mut std::os::raw::c_void;
+    }
+    return 0;
+}
+
+// minimal reader for binary envelopes, only the items that nginx writes
+
+enum Item {
+    Map(u64),
+    Array(u64),
+    Str(std::vec::Vec<u8>),
+    Int(i64),
+    Other
+}
+
+struct Reader<'a> {
+    cbor: bool,
+    buf: &'a [u8],
+    pos: usize
+}
+
+impl<'a> Reader<'a> {
+    fn uint(&mut self, width: usize) -> std::option::Option<u64> {
+        if self.buf.len() - self.pos < width {
+            return None;
+        }
+        let mut res: u64 = 0;
+        for b in &self.buf[self.pos..self.pos + width] {
+            res = (res << 8) | (*b as u64);
+        }
+        self.pos += width;
+        Some(res)
+    }
+
+    fn payload(&mut self, len: u64) -> std::option::Option<std::vec::Vec<u8>> {
+        if ((self.buf.len() - self.pos) as u64) < len {
+            return None;
+        }
+        let res = self.buf[self.pos..self.pos + len as usize].to_vec();
+        self.pos += len as usize;
+        Some(res)
+    }
+
+    fn read(&mut self) -> std::option::Option<Item> {
+        if self.pos >= self.buf.len() {
+            return None;
+        }
+        let head = self.buf[self.pos];
+        self.pos += 1;
+        if self.cbor {
+            self.read_cbor(head)
+        } else {
+            self.read_msgpack(head)
+        }
+    }
+
+    fn read_cbor(&mut self, head: u8) -> std::option::Option<Item> {
+        let info = head & 0x1f;
+        let arg = match info {
+            0..=23 => info as u64,
+            24..=27 => self.uint(1 << (info - 24))?,
+            _ => return None
+        };
+        match head >> 5 {
+            0 => Some(Item::Int(arg as i64)),
+            1 => Some(Item::Int((-1i64).wrapping_sub(arg as i64))),
+            2 => { self.payload(arg)?; Some(Item::Other) },
+            3 => Some(Item::Str(self.payload(arg)?)),
+            4 => Some(Item::Array(arg)),
+            5 => Some(Item::Map(arg)),
+            _ => Some(Item::Other)
+        }
+    }
+
+    fn read_msgpack(&mut self, head: u8) -> std::option::Option<Item> {
+        match head {
+            0x00..=0x7f => Some(Item::Int(head as i64)),
+            0xe0..=0xff => Some(Item::Int(head as i8 as i64)),
+            0x80..=0x8f => Some(Item::Map((head & 0x0f) as u64)),
+            0x90..=0x9f => Some(Item::Array((head & 0x0f) as u64)),
+            0xa0..=0xbf => Some(Item::Str(self.payload((head & 0x1f) as u64)?)),
+            0xc4..=0xc6 => { let len = self.uint(1 << (head - 0xc4))?; self.payload(len)?; Some(Item::Other) },
+            0xca => { self.uint(4)?; Some(Item::Other) },
+            0xcb => { self.uint(8)?; Some(Item::Other) },
+            0xcc..=0xcf => Some(Item::Int(self.uint(1 << (head - 0xcc))? as i64)),
+            0xd3 => Some(Item::Int(self.uint(8)? as i64)),
+            0xd9..=0xdb => { let len = self.uint(1 << (head - 0xd9))?; Some(Item::Str(self.payload(len)?)) },
+            0xdc => Some(Item::Array(self.uint(2)?)),
+            0xdd => Some(Item::Array(self.uint(4)?)),
+            0xde => Some(Item::Map(self.uint(2)?)),
+            0xdf => Some(Item::Map(self.uint(4)?)),
+            _ => Some(Item::Other)
+        }
+    }
+
+    fn skip(&mut self) -> std::option::Option<()> {
+        let mut left: u64 = 1;
+        while left > 0 {
+            left -= 1;
+            match self.read()? {
+                Item::Map(count) => left += count * 2,
+                Item::Array(count) => left += count,
+                _ => ()
+            }
+        }
+        Some(())
+    }
+
+    // returns the value of 'key' entry of the map at current position
+    fn find(&mut self, key: &str) -> std::option::Option<Item> {
+        let count = match self.read()? {
+            Item::Map(count) => count,
+            _ => return None
+        };
+        for _ in 0..count {
+            let found = match self.read()? {
+                Item::Str(st) => st == key.as_bytes(),
+                _ => false
+            };
+            if found {
+                return self.read();
             }
+            self.skip()?;
         }
+        None
+    }
+}
+
+fn binary_request_handle(cbor: bool, req: &[u8]) -> std::option::Option<i64> {
+    let mut reader = Reader { cbor: cbor, buf: req, pos: 0 };
+    let count = match reader.read()? {
+        Item::Map(count) => count,
+        _ => return None
+    };
+    for _ in 0..count {
+        let is_meta = match reader.read()? {
+            Item::Str(st) => st == b"meta",
+            _ => false
+        };
+        if is_meta {
+            return match reader.find("requestHandle")? {
+                Item::Int(handle) => Some(handle),
+                _ => None
+            };
+        }
+        reader.skip()?;
+    }
+    None
+}
+
+// responds with the envelope itself, nginx writes top-level map of 3 entries,
+// its head tells the format
+#[no_mangle]
+pub extern "C"
+fn submit_binary_request(req: *const std::os::raw::c_char, req_len: usize) -> std::os::raw::c_int {
+    let data: std::vec::Vec<u8> = unsafe { std::slice::from_raw_parts(req as *const u8, req_len) }.to_vec();
+    let cbor = data.len() > 0 && 0xa3 == data[0];
+    let handle = match binary_request_handle(cbor, &data) {
+        Some(handle) => handle,
+        None => return -1
+    };
+    std::thread::spawn(move || {
+        let content_type = if cbor { "application/cbor" } else { "application/msgpack" };
+        post_response(handle, data, content_type);
     });
     return 0;
-}
\ No newline at end of file
+}